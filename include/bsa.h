@@ -6,4 +6,5 @@
 #include "types.h"
 
 bool GetMaterialDatabase(const std::string& path, std::vector<char>& bytes);
-bool GetMaterialPathsFromBsa(PathSet& pathSet, const std::string& path);
\ No newline at end of file
+//Table names gets the .mat files stored in the archive itself, for the name dictionary
+bool GetMaterialPathsFromBsa(PathSet& pathSet, const std::string& path, PathSet* tableNames = nullptr);
\ No newline at end of file
@@ -10,12 +10,18 @@
 #include <queue>
 #include <format>
 #include <array>
+#include <sstream>
+#include <memory>
+#include <span>
+#include <cstring>
 
 #include <nlohmann/json.hpp>
 
 #include "crc.h"
+#include "names.h"
 #include "bs.h"
 #include "util.h"
+#include "types.h"
 
 namespace cdb {
 	struct Manager {
@@ -43,7 +49,13 @@ namespace cdb {
 		std::vector<nlohmann::json> componentJsons;
 		std::unordered_map<std::string, nlohmann::json> classJsons;
 		std::vector<uint32_t> posMap;
+		std::vector<uint32_t> chunkCounts;
+		std::vector<bool> componentDiffs;
+		//File position and value of every non zero BSComponentDB2::ID in the component data
+		std::vector<std::pair<uint32_t, uint32_t>> idRefs;
 		std::unordered_map<BSResource::ID, BSComponentDB2::ID> resourceToDb;
+		//Non null persistent ids only, ids shared by several objects map to 0
+		std::unordered_map<BSResource::ID, BSComponentDB2::ID> persistentToDb;
         std::unordered_map<uint32_t, std::string> idToPath;
 
 		FileIndex::ObjectInfo emptyObject{ {0}, 0, 0, false };
@@ -231,12 +243,68 @@ namespace cdb {
 			}
 		};
 
+		//Every resource id in the HashMap and the object list, may contain duplicates
+		std::vector<BSResource::ID> GetDatabaseIds() const {
+			std::vector<BSResource::ID> result;
+			result.reserve(database.HashMap.size() + fileIndex.Objects.size());
+			for (const auto& [id, hash] : database.HashMap) {
+				result.emplace_back(id);
+			}
+			for (const auto& object : fileIndex.Objects) {
+				result.emplace_back(object.PersistentID);
+			}
+			return result;
+		}
+
+		//Fills idToPath with every database object the dictionary has a name for
+		void AddNames(const NameDictionary& names) {
+			for (const auto& [resourceId, dbId] : persistentToDb) {
+				if (!dbId.Value)
+					continue;
+				if (const auto name = names.Find(resourceId))
+					idToPath.emplace(dbId.Value, *name);
+			}
+		}
+
         BSComponentDB2::ID GetMatId(const std::string& path) const {
 			auto matResourceId = GetResourceIdFromPath(path);
 			auto pathIt = resourceToDb.find(matResourceId);
 			return pathIt != resourceToDb.end() ? pathIt->second : BSComponentDB2::ID{ 0 };
 		};
 
+		BSComponentDB2::ID GetObjectId(const std::string& formatedId) const {
+			BSResource::ID resourceId;
+			if (!ParseFormatedResourceId(formatedId, resourceId))
+				return { 0 };
+			auto idIt = persistentToDb.find(resourceId);
+			return idIt != persistentToDb.end() ? idIt->second : BSComponentDB2::ID{ 0 };
+		}
+
+		//Reverse of GetReferencedIds, converts formated resource ids back to database ids
+		void ResolveReferencedIds(nlohmann::json& value) const {
+			if (IsComponentReference(value)) {
+				auto& dbValue = value["Data"]["ID"];
+				if (dbValue.is_string()) {
+					const std::string& idStr = dbValue;
+					if (idStr.starts_with("res:")) {
+						const auto idValue = GetObjectId(idStr);
+						if (idValue.Value)
+							dbValue = std::to_string(idValue.Value);
+						else
+							Log("Object not found or not unique for resource id {}", idStr);
+					}
+				}
+			}
+			else {
+				auto& data = value["Data"];
+				for (auto& member : data) {
+					if (member.is_object() && member.contains("Type")) {
+						ResolveReferencedIds(member);
+					}
+				}
+			}
+		}
+
 		void SetMaterialParent(nlohmann::json& matJson, const std::unordered_map<uint32_t, std::string>& matPathMap,
             const BSComponentDB2::ID matId) const
 		{
@@ -490,6 +558,34 @@ namespace cdb {
 		uint32_t size;
 	};
 
+	//On disk layouts of the DBFileIndex lists, read and written in bulk
+#pragma pack(push, 1)
+	struct PackedObjectInfo {
+		uint32_t file;
+		uint32_t ext;
+		uint32_t dir;
+		uint32_t dbId;
+		uint32_t parent;
+		bool hasData;
+
+		PackedObjectInfo() = default;
+		PackedObjectInfo(const BSComponentDB2::DBFileIndex::ObjectInfo& info) :
+			file(info.PersistentID.file), ext(info.PersistentID.ext), dir(info.PersistentID.dir),
+			dbId(info.DBID.Value), parent(info.Parent.Value), hasData(info.HasData) {}
+
+		operator BSComponentDB2::DBFileIndex::ObjectInfo() const {
+			return { { dir, file, ext }, { dbId }, { parent }, hasData };
+		}
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(PackedObjectInfo) == 0x15);
+	//These already match the on disk layout
+	static_assert(sizeof(BSComponentDB2::DBFileIndex::ComponentInfo) == 0x8);
+	static_assert(sizeof(BSComponentDB2::DBFileIndex::EdgeInfo) == 0xC);
+	static_assert(std::is_trivially_copyable_v<BSComponentDB2::DBFileIndex::ComponentInfo>);
+	static_assert(std::is_trivially_copyable_v<BSComponentDB2::DBFileIndex::EdgeInfo>);
+
 	struct Class {
 
 		enum Flags : uint32_t {
@@ -540,10 +636,11 @@ namespace cdb {
 		uint32_t chunkSize = 0;
 		uint32_t headerChunkSize = 0;
 		uint32_t chunksRemaining = 0;
-		uint32_t userValue = 0;
 
 		std::vector<QueuedChunk> chunkQueue;
 		std::vector<QueuedCast> userQueue;
+		std::vector<std::pair<uint32_t, uint32_t>>* idRefs = nullptr;
+		uint32_t idPos = 0;
 
 	public:
 		Reader(std::istream& _in) : in(_in) {}
@@ -720,6 +817,38 @@ namespace cdb {
 			return *this >> info.PersistentID >> info.DBID >> info.Parent >> info.HasData;
 		}
 
+		//Reads a list chunk of fixed size records straight into the vector
+		template <class T>
+		void ReadPackedList(std::vector<T>& rhs) {
+			Chunk chunk = Read<Chunk>();
+			List list = GetList();
+			if (chunk.size != 0x8u + sizeof(T) * list.size)
+				Error("Unexpected list size {:X} for {} elements", chunk.size, list.size);
+			const size_t begin = rhs.size();
+			rhs.resize(begin + list.size);
+			in.read(reinterpret_cast<char*>(rhs.data() + begin), sizeof(T) * list.size);
+		}
+
+		Reader& operator>>(std::vector<BSComponentDB2::DBFileIndex::ObjectInfo>& rhs) {
+			std::vector<PackedObjectInfo> packed;
+			ReadPackedList(packed);
+			rhs.reserve(rhs.size() + packed.size());
+			for (const auto& info : packed) {
+				rhs.emplace_back(info);
+			}
+			return *this;
+		}
+
+		Reader& operator>>(std::vector<BSComponentDB2::DBFileIndex::ComponentInfo>& rhs) {
+			ReadPackedList(rhs);
+			return *this;
+		}
+
+		Reader& operator>>(std::vector<BSComponentDB2::DBFileIndex::EdgeInfo>& rhs) {
+			ReadPackedList(rhs);
+			return *this;
+		}
+
 		Reader& operator>>(BSComponentDB2::DBFileIndex::ComponentInfo& info) {
 			return *this >> info.ObjectID >> info.Index >> info.Type;
 		}
@@ -910,26 +1039,49 @@ namespace cdb {
 				header.edgeMap[edge.SourceID.Value].emplace_back(edge, i);
 			}
 
+			//Objects without a persistent id aren't indexed, ids shared by several objects map to 0 so they never resolve to the wrong one
+			header.persistentToDb.reserve(header.fileIndex.Objects.size());
+			size_t sharedIds = 0;
 			for (const auto& object : header.fileIndex.Objects) {
+				const auto& id = object.PersistentID;
+				if (id.dir || id.file || id.ext) {
+					const auto [it, added] = header.persistentToDb.emplace(id, object.DBID);
+					if (!added && it->second.Value) {
+						it->second = BSComponentDB2::ID{ 0 };
+						sharedIds++;
+					}
+				}
 				if (object.PersistentID.ext == 'tam') {
 					header.resourceToDb.emplace(object.PersistentID, object.DBID);
 				}
 			}
+			if (sharedIds)
+				Log("{} persistent ids are shared by several objects and can't be resolved", sharedIds);
 
 			return true;
 		}
 
 		bool ReadAllComponents(Manager& header) {
 			try {
-				header.posMap.reserve(header.fileIndex.Components.size());
+				idRefs = &header.idRefs;
+				header.posMap.reserve(header.fileIndex.Components.size() + 1);
+				header.chunkCounts.reserve(header.fileIndex.Components.size());
+				header.componentDiffs.reserve(header.fileIndex.Components.size());
 				for (int i = 0; i < header.fileIndex.Components.size(); ++i) {
 					header.posMap.emplace_back((uint32_t)in.tellg());
+					header.componentDiffs.emplace_back(in.peek() == 'D');
+					const auto remaining = chunksRemaining;
 					auto& component = header.fileIndex.Components.at(i);
 					auto& emplaced = header.componentJsons.emplace_back(nlohmann::json::object());
 					ReadNextObject(emplaced);
+					header.chunkCounts.emplace_back(remaining - chunksRemaining);
 				}
+				//End of the last component so every component region is posMap[i] to posMap[i + 1]
+				header.posMap.emplace_back((uint32_t)in.tellg());
+				idRefs = nullptr;
 			}
 			catch (std::exception& e) {
+				idRefs = nullptr;
 				Log("{}", e.what());
 				return false;
 			}
@@ -1042,11 +1194,20 @@ namespace cdb {
 				User user;
 				*this >> user;
 
-				auto&& cast = std::move(userQueue.back());
+				const auto cast = userQueue.back();
 				userQueue.pop_back();
 
 				ReadType(cast.value, user.casted, chunk.IsDiff(), true);
-				*this >> userValue;
+				//Trailing value of unknown use, kept in the json when set so the Writer can put it back
+				//Builtin casts are wrapped in an object to have somewhere to keep it
+				const uint32_t userValue = Read();
+				if (userValue) {
+					if (!cast.value.is_object()) {
+						auto data = std::move(cast.value);
+						cast.value = { { "Type", GetString(user.casted) }, { "Data", std::move(data) } };
+					}
+					cast.value["UserValue"] = std::to_string(userValue);
+				}
 				break;
 			}
 			case Chunk::LIST:
@@ -1129,13 +1290,17 @@ namespace cdb {
 				if (_stricmp("BSComponentDB2::ID", typeName) == 0) {
 					uint32_t id = 0;
 					if (!isDiff) {
+						idPos = Pos();
 						id = Read();
 					}
 					else {
 						auto fieldPadBegin = Read<uint16_t>();
+						idPos = Pos();
 						id = Read();
 						auto fieldPadEnd = Read<uint16_t>();
 					}
+					if (id != 0 && idRefs)
+						idRefs->emplace_back(idPos, id);
 					value = id != 0 ? std::to_string(id) : "";
 				}
 				else {
@@ -1279,6 +1444,7 @@ namespace cdb {
 		inline uint32_t Size() const { return (uint32_t)buf.size(); }
 		inline const char* Data() const { return buf.data(); }
 		inline void Clear() { buf.clear(); }
+		inline void Reserve(uint32_t size) { buf.reserve(buf.size() + size); }
 
 		template <class T = uint32_t>
 		Buffer& operator<<(const T& rhs) {
@@ -1295,6 +1461,144 @@ namespace cdb {
 		}
 	};
 
+	//Class metadata compiled once per header, so json can be encoded in one pass without searching the class list
+	class Schema {
+	public:
+		struct Encoder {
+			const Class* type = nullptr;
+			TypeRef ref{ TypeRef::Npos };
+			std::vector<TypeRef> fields;
+			InsensitiveMap<std::string, uint16_t> fieldIndex;
+			//Inline size in bytes, 0 if the layout contains strings or refs
+			uint32_t fixedSize = 0;
+			bool isUser = false;
+
+			operator bool() const { return type != nullptr; }
+		};
+
+	private:
+		std::vector<Encoder> encoders;
+		InsensitiveMap<std::string, uint32_t> nameIndex;
+		InsensitiveMap<std::string, TypeRef> builtinIndex;
+		std::unordered_map<uint32_t, uint32_t> refIndex;
+		TypeRef idRef{ TypeRef::Npos };
+		const Encoder emptyEncoder{};
+
+		static uint32_t GetBuiltinSize(const TypeRef ref) {
+			switch (ref.data) {
+			case TypeRef::Int8:
+			case TypeRef::UInt8:
+			case TypeRef::Bool: return 1;
+			case TypeRef::Int16:
+			case TypeRef::UInt16: return 2;
+			case TypeRef::Null:
+			case TypeRef::Int32:
+			case TypeRef::UInt32:
+			case TypeRef::Float: return 4;
+			case TypeRef::Int64:
+			case TypeRef::UInt64:
+			case TypeRef::Double: return 8;
+			//Written as their own chunks
+			case TypeRef::List:
+			case TypeRef::Map: return 0;
+			default: return Npos;
+			}
+		}
+
+		static constexpr uint32_t Npos = 0xFFFFFFFFu;
+
+		uint32_t GetFixedSize(Encoder& encoder, std::vector<uint8_t>& visited) {
+			const uint32_t idx = (uint32_t)(&encoder - encoders.data());
+			if (visited[idx] == 2)
+				return encoder.fixedSize ? encoder.fixedSize : Npos;
+			if (visited[idx] == 1)
+				return Npos;
+			visited[idx] = 1;
+
+			uint32_t size = 0;
+			for (const auto field : encoder.fields) {
+				uint32_t fieldSize = Npos;
+				if (field.IsBuiltin()) {
+					fieldSize = GetBuiltinSize(field);
+				}
+				else if (field == idRef) {
+					fieldSize = 4;
+				}
+				else {
+					auto refIt = refIndex.find(field.data);
+					if (refIt != refIndex.end() && !encoders[refIt->second].isUser)
+						fieldSize = GetFixedSize(encoders[refIt->second], visited);
+				}
+				if (fieldSize == Npos) {
+					size = Npos;
+					break;
+				}
+				size += fieldSize;
+			}
+
+			visited[idx] = 2;
+			encoder.fixedSize = size != Npos ? size : 0;
+			return size;
+		}
+
+	public:
+		Schema(const std::vector<char>& stringTable, const std::vector<Class>& classes) {
+			for (const auto idx : TypeRef::testStrings) {
+				builtinIndex.emplace(TypeRef::builtinStrings[idx], TypeRef{ 0xFFFFFF00u | idx });
+			}
+
+			//BSComponentDB2::ID is encoded as a plain uint32
+			for (uint32_t offset = 0; offset < stringTable.size(); offset += (uint32_t)strlen(stringTable.data() + offset) + 1) {
+				if (strcmp(stringTable.data() + offset, "BSComponentDB2::ID") == 0) {
+					idRef = { offset };
+					break;
+				}
+			}
+
+			encoders.reserve(classes.size());
+			for (const auto& type : classes) {
+				auto& encoder = encoders.emplace_back();
+				encoder.type = &type;
+				encoder.ref = { type.name.data };
+				encoder.isUser = type.IsUser();
+				encoder.fields.reserve(type.fields.size());
+				for (uint16_t i = 0; i < type.fields.size(); ++i) {
+					const auto& field = type.fields[i];
+					encoder.fields.emplace_back(field.typeId);
+					encoder.fieldIndex.emplace(stringTable.data() + field.name.data, i);
+				}
+				nameIndex.emplace(stringTable.data() + type.name.data, (uint32_t)encoders.size() - 1);
+				refIndex.emplace(type.name.data, (uint32_t)encoders.size() - 1);
+			}
+
+			std::vector<uint8_t> visited(encoders.size());
+			for (auto& encoder : encoders) {
+				GetFixedSize(encoder, visited);
+			}
+		}
+
+		inline TypeRef IdRef() const { return idRef; }
+
+		const Encoder& Get(const TypeRef ref) const {
+			auto it = refIndex.find(ref.data);
+			return it != refIndex.end() ? encoders[it->second] : emptyEncoder;
+		}
+
+		const Encoder& Get(const std::string& typeName) const {
+			auto it = nameIndex.find(typeName);
+			return it != nameIndex.end() ? encoders[it->second] : emptyEncoder;
+		}
+
+		//Class or builtin type by name
+		TypeRef GetTypeRef(const std::string& typeName) const {
+			auto it = nameIndex.find(typeName);
+			if (it != nameIndex.end())
+				return encoders[it->second].ref;
+			auto builtinIt = builtinIndex.find(typeName);
+			return builtinIt != builtinIndex.end() ? builtinIt->second : TypeRef{ TypeRef::Npos };
+		}
+	};
+
 	class Writer {
 	public:
 		struct Header {
@@ -1312,17 +1616,26 @@ namespace cdb {
 		struct QueuedCast {
 			const nlohmann::json& value;
 			TypeRef type;
+			bool isDiff;
 		};
 
 	private:
 		std::ostream& out;
 		const Header& header;
+		std::unique_ptr<Schema> ownedSchema;
+		const Schema& schema;
 		std::vector<char> buffer;
-		std::queue<QueuedChunk> chunkQueue;
-		std::queue<QueuedCast> userQueue;
+		std::vector<QueuedChunk> chunkQueue;
+		std::vector<QueuedCast> userQueue;
+		uint32_t chunksWritten = 0;
 
 	public:
-		Writer(std::ostream& _out, const Header& _header) : out(_out), header(_header) {}
+		Writer(std::ostream& _out, const Header& _header) :
+			out(_out), header(_header), ownedSchema(std::make_unique<Schema>(_header.stringTable, _header.classes)), schema(*ownedSchema) {}
+		//Writers sharing a header can share the compiled schema
+		Writer(std::ostream& _out, const Header& _header, const Schema& _schema) : out(_out), header(_header), schema(_schema) {}
+
+		inline uint32_t ChunksWritten() const { return chunksWritten; }
 
 		template <class T = uint32_t>
 		Writer& operator<<(const T& rhs) {
@@ -1358,6 +1671,12 @@ namespace cdb {
 			return *this;
 		}
 
+		Writer& operator<<(const Chunk& rhs) {
+			out.write(reinterpret_cast<const char*>(&rhs), sizeof(Chunk));
+			chunksWritten++;
+			return *this;
+		}
+
 		template <class T, class U>
 		Writer& operator<<(const std::unordered_map<T, U>& rhs) {
 			//using value_t = std::unordered_map<T, U>::value_type;
@@ -1384,39 +1703,29 @@ namespace cdb {
 			return *this << rhs.SourceID << rhs.TargetID << rhs.Index << rhs.Type;
 		}
 
-		const char* GetString(StringRef ref) const {
-			return header.stringTable.data() + ref.data;
+		Writer& operator<<(const std::vector<BSComponentDB2::DBFileIndex::ObjectInfo>& rhs) {
+			const std::vector<PackedObjectInfo> packed(rhs.begin(), rhs.end());
+			out.write(reinterpret_cast<const char*>(packed.data()), sizeof(PackedObjectInfo) * packed.size());
+			return *this;
 		}
 
-		constexpr static uint32_t npos = 0xFFFFFFFFu;
-
-		const Class emptyClass{};
-		const Class& GetType(const char* typeName) {
-			for (auto& type : header.classes) {
-				if (_stricmp(GetString(type.name), typeName) == 0)
-					return type;
-			}
-			return emptyClass;
+		Writer& operator<<(const std::vector<BSComponentDB2::DBFileIndex::ComponentInfo>& rhs) {
+			out.write(reinterpret_cast<const char*>(rhs.data()), sizeof(BSComponentDB2::DBFileIndex::ComponentInfo) * rhs.size());
+			return *this;
 		}
 
-		const Class& GetType(TypeRef offset) {
-			for (auto& type : header.classes) {
-				if (type.name.data == offset.data)
-					return type;
-			}
-			return emptyClass;
+		Writer& operator<<(const std::vector<BSComponentDB2::DBFileIndex::EdgeInfo>& rhs) {
+			out.write(reinterpret_cast<const char*>(rhs.data()), sizeof(BSComponentDB2::DBFileIndex::EdgeInfo) * rhs.size());
+			return *this;
 		}
 
-		const TypeRef GetBuilinType(const char* typeName) {
-			for (uint32_t i = 0; i < TypeRef::testStrings.size(); ++i) {
-				uint32_t idx = TypeRef::testStrings[i];
-				if (_stricmp(TypeRef::builtinStrings[idx], typeName) == 0)
-					return { 0xFFFFFF00 | idx };
-			}
-			return { TypeRef::Npos };
+		const char* GetString(StringRef ref) const {
+			return header.stringTable.data() + ref.data;
 		}
 
-		uint32_t GetTypeOffset(const char* typeName) {
+		constexpr static uint32_t npos = 0xFFFFFFFFu;
+
+		uint32_t GetTypeOffset(const char* typeName) const {
 			for (auto& type : header.classes) {
 				if (strcmp(GetString(type.name), typeName) == 0)
 					return type.name.data;
@@ -1424,15 +1733,6 @@ namespace cdb {
 			return npos;
 		}
 
-		Class::Field emptyField{ 0, 0, Class::Null, 0 };
-		const Class::Field& GetField(const Class& type, const std::string& fieldName) {
-			for (auto& field : type.fields) {
-				if (_stricmp(GetString(field.name), fieldName.c_str()) == 0)
-					return field;
-			}
-			return emptyField;
-		};
-
 		void WriteHeader() {
 			*this << Chunk{ 'HTEB',  8 } << header.version << header.chunkSize
 				<< Chunk{ 'TRTS', (uint32_t)header.stringTable.size() };
@@ -1448,8 +1748,10 @@ namespace cdb {
 			}
 		}
 
+		//Component added to an existing object
 		struct UpdateInfo {
-
+			nlohmann::json json;
+			BSComponentDB2::ID objectId;
 		};
 
 		struct CreateInfo {
@@ -1458,15 +1760,28 @@ namespace cdb {
 			uint64_t hash;
 		};
 
-		void WriteDatabase(const Manager& manager, const std::vector<CreateInfo>& creates) {
-			*this << Chunk{ 'TJBO', 0x7u + (uint32_t)manager.database.BuildVersion.size() }
-				<< GetTypeOffset("BSMaterial::Internal::CompiledDB") << manager.database.BuildVersion;
+		void WriteDatabase(const Manager& manager, const std::vector<CreateInfo>& creates, const std::vector<UpdateInfo>& appends = {}) {
+			WriteDatabase(manager.database, manager.fileIndex, creates, appends);
+		}
+
+		void WriteDatabase(const Manager::Database& database, const Manager::FileIndex& fileIndex,
+			const std::vector<CreateInfo>& creates, const std::vector<UpdateInfo>& appends)
+		{
+			const auto& GetTypeIndex = [&fileIndex](const std::string& typeName) -> uint16_t {
+				auto it = std::find_if(fileIndex.ComponentTypes.begin(), fileIndex.ComponentTypes.end(), [&typeName](const auto& type) {
+					return _stricmp(type.second.Class.c_str(), typeName.c_str()) == 0;
+				});
+				return it != fileIndex.ComponentTypes.end() ? it->first : 0;
+			};
+
+			*this << Chunk{ 'TJBO', 0x7u + (uint32_t)database.BuildVersion.size() }
+				<< GetTypeOffset("BSMaterial::Internal::CompiledDB") << database.BuildVersion;
 
-			const uint32_t hashmapSize = (uint32_t)manager.database.HashMap.size() + (uint32_t)creates.size();
+			const uint32_t hashmapSize = (uint32_t)database.HashMap.size() + (uint32_t)creates.size();
 
 			*this << Chunk{ 'CPAM', 0xCu + 0x14u * hashmapSize }
 				<< GetTypeOffset("BSResource::ID") << TypeRef::UInt64 << hashmapSize
-				<< manager.database.HashMap;
+				<< database.HashMap;
 
 			for (auto& info : creates) {
 				*this << info.id << info.hash;
@@ -1474,28 +1789,28 @@ namespace cdb {
 
 			*this << Chunk{ 'TSIL', 0x8u } << TypeRef::Null << 0u
 				<< Chunk{ 'TSIL', 0x8u } << TypeRef::Null << 0u
-				<< Chunk{ 'TJBO', 0x5u } << GetTypeOffset("BSComponentDB2::DBFileIndex") << manager.fileIndex.Optimized
-				<< Chunk{ 'CPAM', 0xCu + 0x5u * (uint32_t)manager.fileIndex.ComponentTypes.size() }
+				<< Chunk{ 'TJBO', 0x5u } << GetTypeOffset("BSComponentDB2::DBFileIndex") << fileIndex.Optimized
+				<< Chunk{ 'CPAM', 0xCu + 0x5u * (uint32_t)fileIndex.ComponentTypes.size() }
 				<< TypeRef::UInt16 << GetTypeOffset("BSComponentDB2::DBFileIndex::ComponentTypeInfo") 
-				<< (uint32_t)manager.fileIndex.ComponentTypes.size();
+				<< (uint32_t)fileIndex.ComponentTypes.size();
 
-			for (auto& [key, value] : manager.fileIndex.ComponentTypes) {
+			for (auto& [key, value] : fileIndex.ComponentTypes) {
 				*this << key << value.Version << value.IsEmpty;
 			}
 			auto classReferenceType = GetTypeOffset("ClassReference");
-			for (auto& [key, value] : manager.fileIndex.ComponentTypes) {
+			for (auto& [key, value] : fileIndex.ComponentTypes) {
 				*this << Chunk{ 'RESU', 0xF + (uint32_t)value.Class.size() }
 					<< classReferenceType << TypeRef::String << value.Class << 0u;
 			}
 
-			uint32_t objectsSize = (uint32_t)manager.fileIndex.Objects.size();
+			uint32_t objectsSize = (uint32_t)fileIndex.Objects.size();
 			for (auto& info : creates) {
 				objectsSize += (uint32_t)info.json["Objects"].size();
 			}
 
 			*this << Chunk{ 'TSIL', 0x8u + 0x15 * objectsSize }
 				<< GetTypeOffset("BSComponentDB2::DBFileIndex::ObjectInfo") << objectsSize
-				<< manager.fileIndex.Objects;
+				<< fileIndex.Objects;
 
 			//uint32_t objectId = manager.nextObjectId;
 			for (auto& info : creates) {
@@ -1509,8 +1824,7 @@ namespace cdb {
 				}
 			}
 
-			//uint32_t componentsSize = (uint32_t)manager.fileIndex.Components.size();
-			uint32_t componentsSize = 0;
+			uint32_t componentsSize = (uint32_t)fileIndex.Components.size() + (uint32_t)appends.size();
 			for (auto& info : creates) {
 				auto& objects = info.json["Objects"];
 				for (auto& object : objects) {
@@ -1519,7 +1833,14 @@ namespace cdb {
 			}
 			*this << Chunk{ 'TSIL', 0x8u + 0x8u * componentsSize }
 				<< GetTypeOffset("BSComponentDB2::DBFileIndex::ComponentInfo") << componentsSize
-				<< manager.fileIndex.Components;
+				<< fileIndex.Components;
+
+			for (auto& info : appends) {
+				uint16_t index = info.json["Index"];
+				const std::string& typeName = info.json["Type"];
+				uint16_t type = GetTypeIndex(typeName);
+				*this << BSComponentDB2::DBFileIndex::ComponentInfo{ info.objectId, index, type };
+			}
 
 			//objectId = manager.nextObjectId;
 			for (auto& info : creates) {
@@ -1531,16 +1852,16 @@ namespace cdb {
 					for (auto& component : components) {
 						uint16_t index = component["Index"];
 						const std::string& typeName = component["Type"];
-						uint16_t type = manager.GetTypeIndex(typeName.c_str());
+						uint16_t type = GetTypeIndex(typeName);
 						*this << BSComponentDB2::DBFileIndex::ComponentInfo{ objectId, index, type };
 					}
 					//objectId++;
 				}
 			}
 
-			*this << Chunk{ 'TSIL', 0x8u + 0xCu * (uint32_t)manager.fileIndex.Edges.size() }
-				<< GetTypeOffset("BSComponentDB2::DBFileIndex::EdgeInfo") << (uint32_t)manager.fileIndex.Edges.size()
-				<< manager.fileIndex.Edges;
+			*this << Chunk{ 'TSIL', 0x8u + 0xCu * (uint32_t)fileIndex.Edges.size() }
+				<< GetTypeOffset("BSComponentDB2::DBFileIndex::EdgeInfo") << (uint32_t)fileIndex.Edges.size()
+				<< fileIndex.Edges;
 		}
 
 		void WriteChunk(Reader& reader) {
@@ -1562,125 +1883,170 @@ namespace cdb {
 			}
 		}
 
-		void WriteComponentJson(const nlohmann::json& json) {
+		//Diffs only contain the fields present in the json, see Manager::componentDiffs
+		void WriteComponentJson(const nlohmann::json& json, bool isDiff = false) {
 			const std::string& typeName = json["Type"];
-			const auto& type = GetType(typeName.c_str());
-			if (!type)
-				Error("Failed to get component type");
+			const auto& encoder = schema.Get(typeName);
+			if (!encoder)
+				Error("Failed to get component type {}", typeName);
 
 			Buffer buf;
-			WriteObject(json, type, buf);
-			*this << Chunk{ 'TJBO', buf.Size() + 0x4u } << type.name.data << buf;
+			WriteObject(json, encoder, buf, isDiff);
+			*this << Chunk{ isDiff ? Chunk::DIFF : Chunk::OBJT, buf.Size() + 0x4u } << encoder.ref << buf;
 
-			while (chunkQueue.size()) {
-				auto&& chunk = std::move(chunkQueue.front());
-				chunkQueue.pop();
+			//The reader pops queued chunks from the back, so they are written in the same order
+			while (chunkQueue.size() || userQueue.size()) {
 				buf.Clear();
-				if (chunk.value.is_object()) {
-					WriteMap(chunk.value, buf);
-				}
-				else if (chunk.value.is_array()) {
-					WriteList(chunk.value, buf);
+				if (chunkQueue.size()) {
+					const auto chunk = chunkQueue.back();
+					chunkQueue.pop_back();
+					if (IsMap(chunk.value))
+						WriteMap(chunk.value, buf, chunk.isDiff);
+					else
+						WriteList(chunk.value, buf, chunk.isDiff);
 				}
-			}
-			while (userQueue.size()) {
-				auto&& cast = std::move(userQueue.front());
-				userQueue.pop();
+				else {
+					const auto cast = userQueue.back();
+					userQueue.pop_back();
 
-				const std::string& castName = cast.value["Type"];
-				const auto& castType = GetType(castName.c_str());
-				if (!castType)
-					Error("Failed to get component type");
+					const auto userValueIt = cast.value.is_object() ? cast.value.find("UserValue") : cast.value.end();
+					const uint32_t userValue = userValueIt != cast.value.end() ? (uint32_t)std::stoul(userValueIt->get<std::string>()) : 0u;
 
-				buf.Clear();
-				WriteObject(json, castType, buf);
-				//TODO get base type to cast from
-				//TODO get unk Indentation? value
-				*this << Chunk{ 'RESU', buf.Size() } << cast.type << cast.type << buf << 0u;
+					const TypeRef castType = GetJsonType(cast.value);
+					if (castType.IsBuiltin()) {
+						//Builtin casts carrying a user value are wrapped, see Reader::ReadChunk
+						const bool wrapped = userValueIt != cast.value.end();
+						WriteType(wrapped ? cast.value["Data"] : cast.value, castType, buf, cast.isDiff);
+					}
+					else {
+						const auto& castEncoder = schema.Get(castType);
+						if (!castEncoder)
+							Error("Failed to get cast type for {}", GetString(StringRef{ cast.type.data }));
+						WriteObject(cast.value, castEncoder, buf, cast.isDiff);
+					}
+					*this << Chunk{ cast.isDiff ? Chunk::USRD : Chunk::USER, buf.Size() } << cast.type << cast.type << buf << userValue;
+				}
 			}
 		}
 
-		void WriteObject(const nlohmann::json& json, const Class& type, Buffer& buf) {
-			//const std::string& typeName = json["Type"];
-			//const auto& type = GetType(typeName.c_str());
-			//if (!type)
-			//	Error("Failed to get object type");
-			
-			//for (auto dataIt = data.begin(); dataIt != data.end(); ++dataIt) {
-			//	const auto& field = GetField(type, dataIt.key());
-			//	WriteType(*dataIt, field.typeId, buf);
-			//}
+		static bool IsMap(const nlohmann::json& json) {
+			if (!json.is_object())
+				return false;
+			auto it = json.find("ElementType");
+			return it != json.end() && *it == "StdMapType::Pair";
+		}
+
+		//Type a json value was read as
+		TypeRef GetJsonType(const nlohmann::json& json) const {
+			if (json.is_string())
+				return { TypeRef::String };
+			if (!json.is_object())
+				return { TypeRef::Null };
+			auto typeIt = json.find("Type");
+			if (typeIt == json.end())
+				return { TypeRef::Null };
+			const std::string& typeName = *typeIt;
+			if (typeName == "<ref>")
+				return { TypeRef::Ref };
+			if (typeName == "<collection>")
+				return { IsMap(json) ? TypeRef::Map : TypeRef::List };
+			const auto result = schema.GetTypeRef(typeName);
+			if (!result)
+				Error("Failed to find type {}", typeName);
+			return result;
+		}
 
-			if (!json.is_null()) {
-				auto& data = json["Data"];
-				for (auto& field : type.fields) {
-					auto& fieldValue = data[GetString(field.name)];
-					WriteType(fieldValue, field.typeId, buf);
+		void WriteObject(const nlohmann::json& json, const Schema::Encoder& encoder, Buffer& buf, bool isDiff) {
+			static const nlohmann::json nullJson;
+			buf.Reserve(encoder.fixedSize);
+
+			const auto dataIt = json.is_object() ? json.find("Data") : json.end();
+			if (isDiff) {
+				//Field index followed by the value for each field present, terminated by 0xFFFF
+				if (dataIt != json.end() && dataIt->is_object()) {
+					std::vector<const nlohmann::json*> slots(encoder.fields.size(), nullptr);
+					for (auto it = dataIt->begin(); it != dataIt->end(); ++it) {
+						auto fieldIt = encoder.fieldIndex.find(it.key());
+						if (fieldIt != encoder.fieldIndex.end())
+							slots[fieldIt->second] = &*it;
+					}
+					for (uint16_t i = 0; i < encoder.fields.size(); ++i) {
+						if (slots[i]) {
+							buf << i;
+							WriteType(*slots[i], encoder.fields[i], buf, true);
+						}
+					}
+				}
+				buf << (uint16_t)0xFFFFu;
+			}
+			else if (json.is_object() && dataIt != json.end() && dataIt->is_object()) {
+				//Single pass over the json, fields are slotted into declaration order
+				std::vector<const nlohmann::json*> slots(encoder.fields.size(), &nullJson);
+				for (auto it = dataIt->begin(); it != dataIt->end(); ++it) {
+					auto fieldIt = encoder.fieldIndex.find(it.key());
+					if (fieldIt != encoder.fieldIndex.end())
+						slots[fieldIt->second] = &*it;
+				}
+				for (size_t i = 0; i < encoder.fields.size(); ++i) {
+					WriteType(*slots[i], encoder.fields[i], buf, false);
 				}
 			}
 			else {
-				for (auto& field : type.fields) {
-					WriteType(nullptr, field.typeId, buf);
+				for (const auto field : encoder.fields) {
+					WriteType(nullJson, field, buf, false);
 				}
 			}
 		}
 
 		TypeRef GetElementType(const nlohmann::json& json) {
-			TypeRef result;
 			const std::string& elementTypeName = json["ElementType"];
-			const auto& elementType = GetType(elementTypeName.c_str());
-			if (elementType) {
-				result = { elementType.name.data };
-			}
-			else {
-				result = GetBuilinType(elementTypeName.c_str());
-				if (!result)
-					Error("Failed to find element type {}", elementTypeName);
-			}
+			const TypeRef result = schema.GetTypeRef(elementTypeName);
+			if (!result)
+				Error("Failed to find element type {}", elementTypeName);
 			return result;
 		}
 
-		void WriteList(const nlohmann::json& json, Buffer& buf) {
-			const auto& data = json["Data"];
-			if (data.size() == 0) {
+		void WriteList(const nlohmann::json& json, Buffer& buf, bool isDiff) {
+			const auto dataIt = json.is_object() ? json.find("Data") : json.end();
+			if (dataIt == json.end() || dataIt->empty()) {
 				*this << Chunk{ 'TSIL', 0x8u } << TypeRef::Null << 0u;
 				return;
 			}
+			const auto& data = *dataIt;
 
 			const std::string& typeName = json["Type"];
-			if (_stricmp(typeName.c_str(), "<collection>") != 0)
+			if (typeName != "<collection>")
 				Error("List was not a <collection>");
 
-			TypeRef typeRef = GetElementType(json);
-			if (!typeRef)
-				Error("Failed to find element type");
+			const TypeRef typeRef = GetElementType(json);
+			const auto& encoder = schema.Get(typeRef);
+			if (encoder)
+				buf.Reserve(encoder.fixedSize * (uint32_t)data.size());
 
-			for (uint32_t i = 0; i < data.size(); ++i) {
-				WriteType(data[i], typeRef, buf);
+			for (const auto& element : data) {
+				WriteType(element, typeRef, buf, isDiff);
 			}
 			*this << Chunk{ 'TSIL', buf.Size() + 0x8u } << typeRef << data.size() << buf;
 		}
 
-		void WriteMap(const nlohmann::json& json, Buffer& buf) {
-			auto& data = json["Data"];
-			if (data.size() == 0) {
+		void WriteMap(const nlohmann::json& json, Buffer& buf, bool isDiff) {
+			const auto dataIt = json.find("Data");
+			if (dataIt == json.end() || !dataIt->is_array() || dataIt->empty()) {
 				*this << Chunk{ 'CPAM', 0xCu } << TypeRef::Null << TypeRef::Null << 0u;
 				return;
 			}
-			const std::string& typeName = json["Type"];
-			if (_stricmp(typeName.c_str(), "<collection>") != 0)
-				Error("List was not a <collection>");
-			//TypeRef typeRef = GetElementType(json);
-			//if (!typeRef)
-			//	Error("Failed to find element type");
-			for (auto it = data.begin(); it != data.end(); ++it) {
-				buf << it.key();
-				WriteType(*it, { TypeRef::Ref }, buf);
+			const auto& data = *dataIt;
+
+			for (const auto& pair : data) {
+				const auto& pairData = pair["Data"];
+				const std::string& key = pairData["Key"];
+				buf << key;
+				WriteType(pairData["Value"], { TypeRef::Ref }, buf, isDiff);
 			}
 			*this << Chunk{ 'CPAM', buf.Size() + 0xCu } << TypeRef::String << TypeRef::Ref << data.size() << buf;
 		}
 
-		void WriteType(const nlohmann::json& json, const TypeRef ref, Buffer& buf) {
+		void WriteType(const nlohmann::json& json, const TypeRef ref, Buffer& buf, bool isDiff) {
 			if (!json.is_null()) {
 				switch (ref.data) {
 				case TypeRef::Null: buf << 0u; break;
@@ -1693,46 +2059,47 @@ namespace cdb {
 				case TypeRef::UInt32: { const std::string& str = json; buf << (uint32_t)std::stoul(str); break; }
 				case TypeRef::Int64: { const std::string& str = json; buf << (int64_t)std::stoll(str); break; }
 				case TypeRef::UInt64: { const std::string& str = json; buf << (uint64_t)std::stoull(str); break; }
-				//case TypeRef::Bool: buf << json.get<bool>(); break;
 				case TypeRef::Bool: { const std::string& str = json; buf << (_stricmp(str.c_str(), "true") == 0); break; }
 				case TypeRef::Float: { const std::string& str = json; buf << (float)std::stof(str); break; }
 				case TypeRef::Double: { const std::string& str = json; buf << (double)std::stod(str); break; }
 				case TypeRef::List:
 				case TypeRef::Map:
 				{
-					chunkQueue.push({ json, false });
+					chunkQueue.emplace_back(json, isDiff);
 					break;
 				}
 				case TypeRef::Ref:
 				{
 					const std::string& typeName = json["Type"];
-					auto& dataValue = json["Data"];
-					if (typeName == "<ref>") {
-						userQueue.emplace(dataValue, ref);
-					}
-					else {
-						const auto& refType = GetType(typeName.c_str());
-						WriteType(dataValue, { refType.name.data }, buf);
-					}
+					const auto& dataValue = json["Data"];
+					if (typeName == "<ref>")
+						userQueue.emplace_back(dataValue, ref, isDiff);
+					else
+						WriteType(dataValue, schema.GetTypeRef(typeName), buf, isDiff);
 					break;
 				}
 				default:
 				{
-					//const std::string& typeName = json["Type"];
-					auto& type = GetType(ref);
-					const char* typeName = GetString({ type.name.data });
-					//WriteObject(json, type, buf);
-					if (_stricmp(typeName, "BSComponentDB2::ID") == 0) {
-						//const std::string& id = json["Data"]["ID"];
+					if (ref == schema.IdRef()) {
 						const std::string& id = json;
+						//Diffs pad the id on both sides
+						if (isDiff)
+							buf << (uint16_t)0;
 						if (id.size())
 							buf << (uint32_t)std::stoul(id);
 						else
 							buf << 0u;
+						if (isDiff)
+							buf << (uint16_t)0;
+						break;
 					}
-					else {
-						WriteObject(json, type, buf);
-					}
+					const auto& encoder = schema.Get(ref);
+					if (!encoder)
+						Error("Type not found: {:08X}", ref.data);
+					if (encoder.isUser)
+						userQueue.emplace_back(json, ref, isDiff);
+					else
+						WriteObject(json, encoder, buf, isDiff);
 				}
 				}
 			}
@@ -1754,40 +2121,372 @@ namespace cdb {
 				case TypeRef::List:
 				case TypeRef::Map:
 				{
-					chunkQueue.push({ json, false });
-					break;
-				}
-				case TypeRef::Ref:
-				{
-					//const std::string& typeName = json["Type"];s
-					//auto& dataValue = json["Data"];
-					//if (typeName == "<ref>") {
-					//	userQueue.emplace(dataValue, ref);
-					//}
-					//else {
-					//const auto& refType = GetType(typeRef);
-					//WriteType(dataValue, { refType.name.data }, buf);
-					//}
-					buf << 0u;
+					chunkQueue.emplace_back(json, isDiff);
 					break;
 				}
+				case TypeRef::Ref: buf << 0u; break;
 				default:
 				{
-					//const std::string& typeName = json["Type"];
-					auto& type = GetType(ref);
-					const char* typeName = GetString({ type.name.data });
-					//WriteObject(json, type, buf);
-					if (_stricmp(typeName, "BSComponentDB2::ID") == 0) {
-						//const std::string& id = json;
-						//buf << (uint32_t)std::stoul(id);
+					if (ref == schema.IdRef()) {
+						if (isDiff)
+							buf << (uint16_t)0;
 						buf << 0u;
+						if (isDiff)
+							buf << (uint16_t)0;
+						break;
+					}
+					const auto& encoder = schema.Get(ref);
+					if (!encoder)
+						Error("Type not found: {:08X}", ref.data);
+					if (encoder.isUser)
+						userQueue.emplace_back(json, ref, isDiff);
+					else
+						WriteObject(json, encoder, buf, isDiff);
+				}
+				}
+			}
+		}
+	};
+
+	//Plans the whole output file before writing. Components are serialized into independent buffers in parallel,
+	//so the header chunk count and the offset of every region are known before anything is written
+	class Layout {
+	public:
+		struct Region {
+			uint32_t srcBegin = 0;
+			uint32_t srcEnd = 0;
+			uint32_t chunkCount = 0;
+			const nlohmann::json* json = nullptr;
+			std::string data;
+			uint64_t offset = 0;
+			//Source position and new value of ids rewritten while copying
+			std::vector<std::pair<uint32_t, uint32_t>> patches;
+
+			inline bool IsCopy() const { return json == nullptr; }
+			inline uint64_t Size() const { return IsCopy() ? srcEnd - srcBegin : data.size(); }
+		};
+
+	private:
+		static constexpr uint32_t maxCopySize = 0x1000000u;
+
+		const Writer::Header& header;
+		const Schema schema;
+		std::vector<Region> regions;
+		std::string headerData;
+		uint32_t chunkSize = 0;
+		uint64_t size = 0;
+
+	public:
+		Layout(const Writer::Header& _header) : header(_header), schema(_header.stringTable, _header.classes) {}
+
+		inline uint32_t ChunkSize() const { return chunkSize; }
+		inline uint64_t Size() const { return size; }
+		inline const std::vector<Region>& Regions() const { return regions; }
+
+		//Adjacent copies are merged, large copies are split so they can be written in parallel
+		void AddCopy(uint32_t begin, uint32_t end, uint32_t chunkCount, std::span<const std::pair<uint32_t, uint32_t>> patches = {}) {
+			if (!regions.empty()) {
+				auto& last = regions.back();
+				if (last.IsCopy() && last.srcEnd == begin && end - last.srcBegin <= maxCopySize) {
+					last.srcEnd = end;
+					last.chunkCount += chunkCount;
+					last.patches.insert(last.patches.end(), patches.begin(), patches.end());
+					return;
+				}
+			}
+			auto& region = regions.emplace_back();
+			region.srcBegin = begin;
+			region.srcEnd = end;
+			region.chunkCount = chunkCount;
+			region.patches.assign(patches.begin(), patches.end());
+		}
+
+		void AddJson(const nlohmann::json& json) {
+			regions.emplace_back().json = &json;
+		}
+
+		void Serialize() {
+			ParallelFor(regions.size(), [this](size_t i) {
+				auto& region = regions[i];
+				if (region.IsCopy())
+					return;
+				std::ostringstream stream(std::ios::out | std::ios::binary);
+				Writer writer(stream, header, schema);
+				writer.WriteComponentJson(*region.json);
+				region.data = std::move(stream).str();
+				region.chunkCount = writer.ChunksWritten();
+			});
+		}
+
+		//Writes the header and index tables into memory with the final chunk count and assigns every region an offset
+		void Plan(const std::function<void(Writer&)>& writeIndex) {
+			std::ostringstream indexStream(std::ios::out | std::ios::binary);
+			Writer indexWriter(indexStream, header, schema);
+			writeIndex(indexWriter);
+
+			//BETH, STRT, TYPE and a CLAS chunk per class
+			chunkSize = 3 + (uint32_t)header.classes.size() + indexWriter.ChunksWritten();
+			for (const auto& region : regions) {
+				chunkSize += region.chunkCount;
+			}
+
+			const Writer::Header outHeader{ header.version, chunkSize, header.stringTable, header.classes };
+			std::ostringstream headerStream(std::ios::out | std::ios::binary);
+			Writer headerWriter(headerStream, outHeader, schema);
+			headerWriter.WriteHeader();
+			headerData = std::move(headerStream).str();
+			headerData.append(std::move(indexStream).str());
+
+			size = headerData.size();
+			for (auto& region : regions) {
+				region.offset = size;
+				size += region.Size();
+			}
+		}
+
+		//Written next to the target first, so a failed write keeps the old file and the source can be the target
+		bool Write(const std::string& outPath, const std::string& srcPath) const {
+			const auto tmpPath = outPath + ".tmp";
+			std::error_code ec;
+			if (!WriteRegions(tmpPath, srcPath)) {
+				std::filesystem::remove(tmpPath, ec);
+				return false;
+			}
+			std::filesystem::rename(tmpPath, outPath, ec);
+			if (ec) {
+				Log("Failed to replace database {} {}", outPath, ec.message());
+				std::filesystem::remove(tmpPath, ec);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		//Regions are split into one slice per thread, each with its own streams writing at known offsets
+		bool WriteRegions(const std::string& outPath, const std::string& srcPath) const {
+			{
+				std::ofstream create(outPath, std::ios::out | std::ios::binary | std::ios::trunc);
+				if (create.fail())
+					return false;
+				create.write(headerData.data(), headerData.size());
+				if (create.fail())
+					return false;
+			}
+
+			std::error_code ec;
+			std::filesystem::resize_file(outPath, size, ec);
+			if (ec)
+				return false;
+
+			const size_t sliceCount = std::max<size_t>(1, std::min(GetThreadCount(), regions.size()));
+			const size_t sliceSize = (regions.size() + sliceCount - 1) / sliceCount;
+			std::atomic<bool> success = true;
+			ParallelFor(sliceCount, [&](size_t slice) {
+				const size_t begin = slice * sliceSize;
+				const size_t end = std::min(begin + sliceSize, regions.size());
+				if (begin >= end)
+					return;
+
+				std::fstream out(outPath, std::ios::in | std::ios::out | std::ios::binary);
+				std::ifstream in(srcPath, std::ios::in | std::ios::binary);
+				std::vector<char> buffer;
+				for (size_t i = begin; i < end; ++i) {
+					const auto& region = regions[i];
+					out.seekp(region.offset);
+					if (region.IsCopy()) {
+						buffer.resize(region.srcEnd - region.srcBegin);
+						in.seekg(region.srcBegin);
+						in.read(buffer.data(), buffer.size());
+						for (const auto& [pos, value] : region.patches) {
+							std::memcpy(buffer.data() + (pos - region.srcBegin), &value, sizeof(uint32_t));
+						}
+						out.write(buffer.data(), buffer.size());
 					}
 					else {
-						WriteObject(json, type, buf);
+						out.write(region.data.data(), region.data.size());
+					}
+				}
+				if (out.fail() || in.fail())
+					success = false;
+			});
+			return success;
+		}
+	};
+
+	//Renumbers DBIDs densely and stores every material's parent chain and referenced objects next to each other.
+	//Component chunks are copied by offset with their BSComponentDB2::ID values remapped
+	class Optimizer {
+	private:
+		const Manager& manager;
+		std::vector<uint32_t> order;
+		std::vector<uint32_t> idMap;
+		std::vector<uint32_t> componentOrder;
+		//Empty keeps every object
+		std::vector<uint8_t> reachable;
+		Manager::FileIndex fileIndex;
+
+		uint32_t MapId(uint32_t id) const {
+			return id < idMap.size() ? idMap[id] : 0;
+		}
+
+		bool IsKept(uint32_t id) const {
+			return reachable.empty() || (id < reachable.size() && reachable[id]);
+		}
+
+	public:
+		Optimizer(const Manager& _manager) : manager(_manager) {}
+
+		//Marks the objects reachable from .mat resources through parents, edges and ids referenced by components.
+		//Returns the number of unreachable objects that will be dropped
+		size_t Collect() {
+			const auto& components = manager.fileIndex.Components;
+
+			//Range of idRefs inside each component, both are in file order
+			std::vector<uint32_t> refBegin(components.size() + 1);
+			uint32_t refIdx = 0;
+			for (uint32_t i = 0; i < components.size(); ++i) {
+				while (refIdx < manager.idRefs.size() && manager.idRefs[refIdx].first < manager.posMap[i])
+					refIdx++;
+				refBegin[i] = refIdx;
+			}
+			refBegin[components.size()] = (uint32_t)manager.idRefs.size();
+
+			reachable.assign(manager.nextObjectId, 0);
+			std::vector<uint32_t> stack;
+			for (const auto& object : manager.fileIndex.Objects) {
+				if (object.PersistentID.ext == 'tam')
+					stack.emplace_back(object.DBID.Value);
+			}
+
+			while (stack.size()) {
+				const uint32_t id = stack.back();
+				stack.pop_back();
+				if (id >= reachable.size() || reachable[id] || !manager.GetObject({ id }))
+					continue;
+				reachable[id] = 1;
+
+				stack.emplace_back(manager.GetObject({ id }).Parent.Value);
+				for (const auto& ref : manager.GetEdges({ id })) {
+					stack.emplace_back(ref.edge.TargetID.Value);
+				}
+				for (const auto& ref : manager.GetComponents({ id })) {
+					for (uint32_t i = refBegin[ref.idx]; i < refBegin[ref.idx + 1]; ++i) {
+						stack.emplace_back(manager.idRefs[i].second);
+					}
+				}
+			}
+
+			return manager.fileIndex.Objects.size() - std::count(reachable.begin(), reachable.end(), 1);
+		}
+
+		inline const Manager::FileIndex& Index() const { return fileIndex; }
+
+		void Order() {
+			const auto& objects = manager.fileIndex.Objects;
+			idMap.assign(manager.nextObjectId, 0);
+			order.clear();
+			order.reserve(objects.size());
+
+			const auto& Place = [&](uint32_t id) {
+				if (id < idMap.size() && !idMap[id] && IsKept(id) && manager.GetObject({ id })) {
+					order.emplace_back(id);
+					idMap[id] = (uint32_t)order.size();
+				}
+			};
+
+			std::vector<uint32_t> stack;
+			std::vector<uint8_t> expanded(idMap.size());
+			const auto& PlaceClosure = [&](uint32_t rootId) {
+				stack.emplace_back(rootId);
+				while (stack.size()) {
+					const uint32_t id = stack.back();
+					stack.pop_back();
+					if (id >= idMap.size() || expanded[id] || !IsKept(id))
+						continue;
+					expanded[id] = 1;
+					const auto parentList = manager.GetParentList({ id });
+					for (auto parentIt = parentList.rbegin(); parentIt != parentList.rend(); ++parentIt) {
+						Place(parentIt->Value);
+					}
+					const auto& edges = manager.GetEdges({ id });
+					for (auto edgeIt = edges.rbegin(); edgeIt != edges.rend(); ++edgeIt) {
+						stack.emplace_back(edgeIt->edge.TargetID.Value);
 					}
 				}
+			};
+
+			for (const auto& object : objects) {
+				if (object.PersistentID.ext == 'tam')
+					PlaceClosure(object.DBID.Value);
+			}
+			for (const auto& object : objects) {
+				PlaceClosure(object.DBID.Value);
+			}
+
+			Remap();
+		}
+
+		void Remap() {
+			fileIndex.ComponentTypes = manager.fileIndex.ComponentTypes;
+			fileIndex.Optimized = manager.fileIndex.Optimized;
+			fileIndex.Objects.clear();
+			fileIndex.Components.clear();
+			fileIndex.Edges.clear();
+			componentOrder.clear();
+			fileIndex.Objects.reserve(order.size());
+			fileIndex.Components.reserve(manager.fileIndex.Components.size());
+			componentOrder.reserve(manager.fileIndex.Components.size());
+			fileIndex.Edges.reserve(manager.fileIndex.Edges.size());
+
+			uint32_t droppedEdges = 0;
+			const bool collected = !reachable.empty();
+			for (const auto id : order) {
+				const auto& object = manager.GetObject({ id });
+				fileIndex.Objects.push_back({ object.PersistentID, { MapId(id) }, { MapId(object.Parent.Value) }, object.HasData });
+
+				for (const auto& ref : manager.GetComponents({ id })) {
+					fileIndex.Components.push_back({ { MapId(id) }, ref.component.Index, ref.component.Type });
+					componentOrder.emplace_back(ref.idx);
+				}
+
+				for (const auto& ref : manager.GetEdges({ id })) {
+					const auto targetId = MapId(ref.edge.TargetID.Value);
+					if (targetId)
+						fileIndex.Edges.push_back({ { MapId(id) }, { targetId }, ref.edge.Index, ref.edge.Type });
+					else
+						droppedEdges++;
+				}
+			}
+
+			if (droppedEdges)
+				Log("Dropped {} edges to {} objects", droppedEdges, collected ? "unreachable" : "missing");
+		}
+
+		bool Write(const Writer::Header& header, const std::string& srcPath, const std::string& outPath) const {
+			Layout layout(header);
+			std::vector<std::pair<uint32_t, uint32_t>> patches;
+			//References to dropped or missing objects become null, the old id could now belong to an unrelated object
+			uint32_t nulledRefs = 0;
+			for (const auto idx : componentOrder) {
+				const uint32_t begin = manager.posMap[idx];
+				const uint32_t end = manager.posMap[idx + 1];
+				auto refIt = std::lower_bound(manager.idRefs.begin(), manager.idRefs.end(), std::pair<uint32_t, uint32_t>{ begin, 0 });
+				patches.clear();
+				for (; refIt != manager.idRefs.end() && refIt->first < end; ++refIt) {
+					const auto mapped = MapId(refIt->second);
+					if (!mapped && refIt->second)
+						nulledRefs++;
+					patches.emplace_back(refIt->first, mapped);
 				}
+				layout.AddCopy(begin, end, manager.chunkCounts[idx], patches);
 			}
+			if (nulledRefs)
+				Log("Cleared {} references to objects that were dropped or missing", nulledRefs);
+
+			layout.Plan([&](Writer& out) {
+				out.WriteDatabase(manager.database, fileIndex, {}, {});
+			});
+			return layout.Write(outPath, srcPath);
 		}
 	};
 }
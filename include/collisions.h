@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <vector>
+
+#include "bs.h"
+#include "names.h"
+
+struct ResourceIdEntry {
+	BSResource::ID id;
+	uint32_t index;
+};
+
+struct ResourceCollision {
+	BSResource::ID id;
+	std::string path;
+	//The other path with the same id, or the known name of the database entry
+	std::string other;
+	bool database = false;
+};
+
+//Least significant digit radix sort on dir, file, ext
+void SortResourceIds(std::vector<ResourceIdEntry>& entries);
+//Hashes the paths in parallel, entries are sorted by id and index into paths
+std::vector<ResourceIdEntry> GetSortedResourceIds(std::span<const std::string> paths);
+
+//Every pair of different paths with the same id, and every path whose id is already
+//used by databaseIds under another name known to the dictionary
+std::vector<ResourceCollision> FindCollisions(std::span<const std::string> paths, std::span<const BSResource::ID> databaseIds = {}, const NameDictionary* names = nullptr);
@@ -1,9 +1,97 @@
 #pragma once
 
+#include <array>
 #include <string>
+#include <string_view>
+#include <span>
+#include <vector>
 
 #include "bs.h"
+#include "types.h"
 
-uint32_t GetCrc(const std::string_view sv);
-BSResource::ID GetResourceIdFromPath(const std::string& path);
-std::string GetFormatedResourceId(const BSResource::ID& id);
\ No newline at end of file
+//Same values as crcMap in crc.cpp, generated so hashing can run in constant expressions
+constexpr std::array<uint32_t, 256> GetCrcTable() {
+	std::array<uint32_t, 256> result{};
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t value = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			value = value & 1 ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+		}
+		result[i] = value;
+	}
+	return result;
+}
+
+inline constexpr auto crcTable = GetCrcTable();
+
+uint32_t GetCrcRuntime(const std::string_view sv);
+//Continues a crc over more text, GetCrc(a + b) == ContinueCrc(GetCrc(a), b)
+uint32_t ContinueCrc(uint32_t crc, const std::string_view sv);
+
+constexpr uint32_t GetCrc(const std::string_view sv) {
+	if consteval {
+		constexpr auto transform = GetLowerBackslashMap();
+		uint32_t result = 0;
+		for (const auto c : sv) {
+			result = crcTable[(uint8_t)(transform[(uint8_t)c] ^ result)] ^ (result >> 8);
+		}
+		return result;
+	}
+	else {
+		return GetCrcRuntime(sv);
+	}
+}
+
+constexpr uint32_t GetExtension(const std::string_view path, size_t dotPos) {
+	uint32_t result = 0;
+	if (dotPos != std::string_view::npos) {
+		for (size_t i = 0; i < 4 && ++dotPos < path.size(); ++i) {
+			result |= (uint32_t)(uint8_t)path[dotPos] << (i * 8);
+		}
+	}
+	return result;
+}
+
+//Splits a path into the directory and file name that get hashed, dotPos is the last '.'
+constexpr void SplitResourcePath(const std::string_view path, std::string_view& dir, std::string_view& file, size_t& dotPos) {
+	const auto slashPos = path.find_last_of("/\\");
+	dotPos = path.find_last_of('.');
+
+	if (slashPos != std::string_view::npos) {
+		const auto fileEnd = dotPos != std::string_view::npos && dotPos > slashPos ? dotPos : path.size();
+		dir = path.substr(0, slashPos);
+		file = path.substr(slashPos + 1, fileEnd - slashPos - 1);
+	}
+	else {
+		//This isn't correct
+		dir = path;
+		file = path;
+	}
+}
+
+constexpr BSResource::ID GetResourceIdFromPath(const std::string_view path) {
+	std::string_view dir, file;
+	size_t dotPos = 0;
+	SplitResourcePath(path, dir, file, dotPos);
+	return { GetCrc(dir), GetCrc(file), GetExtension(path, dotPos) };
+}
+
+//Resource id hashed at compile time, for paths known up front
+consteval BSResource::ID GetConstResourceId(const std::string_view path) {
+	return GetResourceIdFromPath(path);
+}
+
+//Same as GetResourceIdFromPath for each path, reusing directory hashes across the batch
+std::vector<BSResource::ID> GetResourceIdsFromPaths(std::span<const std::string> paths);
+
+//Length of "res:DIR:FILE:EXT" with each field as 8 hex digits
+constexpr size_t formatedResourceIdSize = 30;
+
+//Writes formatedResourceIdSize chars to out without a terminator, returns the end
+char* FormatResourceId(const BSResource::ID& id, char* out);
+//Writes ids.size() * formatedResourceIdSize chars to out, back to back
+void FormatResourceIds(std::span<const BSResource::ID> ids, char* out);
+std::string GetFormatedResourceId(const BSResource::ID& id);
+bool ParseFormatedResourceId(const std::string_view sv, BSResource::ID& id);
+//Reverse of FormatResourceIds, text must hold exactly ids.size() formated ids
+bool ParseFormatedResourceIds(std::string_view text, std::span<BSResource::ID> ids);
@@ -13,4 +13,13 @@ constexpr std::array rootMaterialPaths{
     "materials\\layered\\root\\layeredmaterials.mat",
 };
 
+//rootMaterialPaths hashed at compile time
+constexpr auto rootMaterialIds = [] {
+    std::array<BSResource::ID, rootMaterialPaths.size()> result{};
+    for (size_t i = 0; i < rootMaterialPaths.size(); ++i) {
+        result[i] = GetResourceIdFromPath(rootMaterialPaths[i]);
+    }
+    return result;
+}();
+
 bool ExportMaterial(const std::string& inPath, const std::string& outPath, const cdb::Manager& manager);
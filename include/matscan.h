@@ -0,0 +1,30 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "types.h"
+
+//Finds null terminated ".mat" paths preceded by their uint16 size in plugin data fed a block at a time.
+//Matches exactly what the original byte at a time ring buffer search found, including its quirks
+class MatPathScanner {
+	//Enough bytes before any unsearched position for the longest size prefix the search accepts
+	static constexpr size_t historySize = 0x140;
+
+	std::vector<char> buffer;
+	size_t historyLength = 0;
+	//Trailing history positions that couldn't be searched yet because the match ran past the block
+	size_t unsearched = 0;
+	//State of the ".mat" matcher before buffer[0]
+	uint32_t historyState = 0;
+
+public:
+	//Starts a new segment, bytes before it read as zero
+	void Reset();
+
+	//Space for the next size bytes of the segment, call Scan with the count actually written
+	std::span<char> Prepare(size_t size);
+	void Scan(size_t size, PathSet& result);
+
+	void Scan(std::span<const char> data, PathSet& result);
+};
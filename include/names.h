@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <filesystem>
+#include <vector>
+#include <unordered_map>
+
+#include "bs.h"
+#include "types.h"
+
+//The dictionary all tools share, "names_path" from Settings.json next to the exe or Names.dat beside it
+std::string GetNameDictionaryPath(const std::filesystem::path& exeFolder);
+
+//Persistent map of resource ids back to the paths they were hashed from
+class NameDictionary {
+	std::unordered_map<BSResource::ID, std::string> names;
+
+public:
+	//Returns the number of ids that weren't named yet, existing names are kept
+	size_t Add(std::span<const std::string> paths);
+	size_t Add(const PathSet& paths);
+	size_t Merge(const NameDictionary& other);
+
+	const std::string* Find(const BSResource::ID& id) const {
+		const auto it = names.find(id);
+		return it != names.end() ? &it->second : nullptr;
+	}
+
+	size_t Size() const { return names.size(); }
+
+	template<typename Functor>
+	void ForEach(Functor&& functor) const {
+		for (const auto& [id, path] : names) {
+			functor(id, path);
+		}
+	}
+
+	//Merges the file into the dictionary, a missing file is an empty dictionary
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+};
@@ -4,9 +4,33 @@
 #include <string>
 #include <filesystem>
 #include <fstream>
+#include <span>
+#include <functional>
 
 #include "types.h"
 
+class ScanCache;
+
 bool GetMaterialPathsFromNifPath(PathSet& result, const std::filesystem::path& path);
 bool GetMaterialPathsFromNifStream(PathSet& result, std::istream& stream);
-bool GetMaterialPathsFromNifsRecursive(PathSet& result, const std::filesystem::path& folder);
\ No newline at end of file
+//Nifs whose size and write time match the cache reuse the paths found last time
+bool GetMaterialPathsFromNifsRecursive(PathSet& result, const std::filesystem::path& folder, ScanCache* cache = nullptr);
+
+enum class NifHeaderResult {
+	Done,
+	//The data ends before the string table does
+	Truncated,
+	//Not a header this scanner knows, use nifly instead
+	Unsupported,
+};
+
+//Reads only the header string table, paths are added only when the result is Done
+NifHeaderResult GetMaterialPathsFromNifHeader(PathSet& result, std::span<const char> data);
+NifHeaderResult GetMaterialPathsFromNifHeader(PathSet& result, std::istream& stream);
+
+//Returns true after replacing the string with its new path
+using NifStringRetarget = std::function<bool(std::string& string)>;
+
+//Rewrites the .mat names of a nif to outPath, which can be the same path, only when any change
+//The header string table is patched directly, nifly is only used for headers the scanner doesn't know
+bool RetargetNifMaterials(const std::filesystem::path& path, const std::filesystem::path& outPath, const NifStringRetarget& retarget, size_t& changed, std::vector<char>& buffer);
\ No newline at end of file
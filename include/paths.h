@@ -5,12 +5,18 @@
 #include <functional>
 #include <filesystem>
 
+#include "names.h"
+#include "scancache.h"
+
 struct PathInfo {
     const std::function<void(const char*)>& LogHelp;
-    std::vector<std::string> paths;
     std::vector<std::string> materials;
     std::string cdb;
     std::string exe;
+    std::string namesPath;
+    NameDictionary names;
+    std::string scanCachePath;
+    ScanCache scanCache;
     bool noWait = false;
 };
 
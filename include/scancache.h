@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+
+#include "types.h"
+
+//Persistent record of the material paths each archive, plugin or mesh produced, reused until the source changes
+class ScanCache {
+public:
+	struct Stamp {
+		uint64_t size = 0;
+		int64_t time = 0;
+		//Only set when hashContents is on
+		uint64_t hash = 0;
+
+		bool operator==(const Stamp&) const = default;
+	};
+
+	struct Entry {
+		Stamp stamp;
+		std::vector<std::string> paths;
+		//Names the source adds to the name dictionary, like the .mat files inside an archive
+		std::vector<std::string> names;
+	};
+
+private:
+	std::unordered_map<std::string, Entry> entries;
+	bool changed = false;
+
+public:
+	bool hashContents = false;
+	//Misses every lookup so all sources are scanned again, the results are still recorded
+	bool rescan = false;
+
+	bool GetStamp(const std::filesystem::path& path, Stamp& stamp) const;
+	bool GetStamp(const std::filesystem::directory_entry& entry, Stamp& stamp) const;
+
+	//Returns what the source gave last time, or nullptr when it's new or its stamp changed
+	//With hashContents only the size and hash have to match, so retouched files with the same bytes still hit
+	const Entry* Find(const std::string& source, const Stamp& stamp) const;
+	void Set(const std::string& source, const Stamp& stamp, const PathSet& paths, const PathSet* names = nullptr);
+
+	bool Changed() const { return changed; }
+
+	//A missing file is an empty cache
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+};
@@ -3,6 +3,14 @@
 #include <string>
 #include <format>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <algorithm>
 
 bool HasExtension(const std::string& str, const char* ext);
 bool HasExtension(const std::wstring& str, const wchar_t* ext);
@@ -19,4 +27,88 @@ void Error(std::format_string<Args...> fmt, Args&&... args) {
     const auto message = std::format(fmt, std::forward<Args>(args)...);
     std::cout << message << "\n";
     throw std::exception();
-}
\ No newline at end of file
+}
+
+inline size_t GetThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline size_t GetWorkerCount(size_t count) {
+    return std::min(GetThreadCount(), count);
+}
+
+//Calls functor(worker, i) for every i in [0, count) across all cores, worker is below GetWorkerCount(count) for per thread state.
+//The first exception thrown is rethrown after all threads finish
+template<typename Functor>
+void ParallelForWorker(size_t count, Functor&& functor) {
+    const size_t threadCount = GetWorkerCount(count);
+    std::atomic<size_t> next = 0;
+    std::exception_ptr exception;
+    std::mutex exceptionLock;
+    {
+        std::vector<std::jthread> threads;
+        threads.reserve(threadCount);
+        for (size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t]() {
+                try {
+                    for (size_t i = next++; i < count; i = next++)
+                        functor(t, i);
+                }
+                catch (...) {
+                    std::lock_guard lock(exceptionLock);
+                    if (!exception)
+                        exception = std::current_exception();
+                    next = count;
+                }
+            });
+        }
+    }
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+//Calls functor(i) for every i in [0, count) across all cores. The first exception thrown is rethrown after all threads finish
+template<typename Functor>
+void ParallelFor(size_t count, Functor&& functor) {
+    ParallelForWorker(count, [&functor](size_t, size_t i) {
+        functor(i);
+    });
+}
+
+//Fixed capacity queue from a producer to worker threads, Push blocks while full and Pop returns false once closed and drained
+template<typename T>
+class BoundedQueue {
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    const size_t capacity;
+    bool closed = false;
+
+public:
+    BoundedQueue(size_t _capacity) : capacity(std::max<size_t>(1, _capacity)) {}
+
+    void Push(T item) {
+        std::unique_lock guard(lock);
+        notFull.wait(guard, [this]() { return items.size() < capacity; });
+        items.emplace_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool Pop(T& item) {
+        std::unique_lock guard(lock);
+        notEmpty.wait(guard, [this]() { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "types.h"
 #include "bsa.h"
 #include "cdb.h"
+#include "mat.h"
 #include "util.h"
 #include "paths.h"
 
@@ -49,14 +50,13 @@ bool DumpMats(const PathInfo& paths) {
         return false;
     }
 
-    std::unordered_map<uint32_t, std::string> idToPath;
-    for (auto& path : paths.paths) {
-        auto resourceId = GetResourceIdFromPath(path);
-        auto idIt = header.resourceToDb.find(resourceId);
+    for (size_t i = 0; i < rootMaterialIds.size(); ++i) {
+        auto idIt = header.resourceToDb.find(rootMaterialIds[i]);
         if (idIt != header.resourceToDb.end()) {
-            idToPath.emplace(idIt->second.Value, path);
+            header.idToPath.emplace(idIt->second.Value, rootMaterialPaths[i]);
         }
     }
+    header.AddNames(paths.names);
  
     Log("Writing materials");
     for (auto& path : paths.materials) {
@@ -64,7 +64,7 @@ bool DumpMats(const PathInfo& paths) {
         if (matId.Value && header.GetComponents(matId).size()) {
             try {
                 nlohmann::json matJson;
-                header.CreateMaterialJson(matJson, matId, idToPath);
+                header.CreateMaterialJson(matJson, matId, header.idToPath);
                 const auto outPath = std::filesystem::path(paths.exe).remove_filename().append(path).string();
                 if (CreateDirectories(outPath)) {
                     std::ofstream out(outPath, std::ios::out | std::ios::binary);
@@ -109,7 +109,8 @@ void LogHelp(const char* exePath) {
         << "\n"
         << "Options: \n"
         << "  -help -h     Shows this help message\n"
-        << "  -nowait -nw  Disables the wait for user input on completion\n";
+        << "  -nowait -nw  Disables the wait for user input on completion\n"
+        << "  -rescan -rs  Scans archives, plugins and nif folders again instead of using ScanCache.dat\n";
 }
 
 int main(int argc, char** argv) {    
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string_view>
 
 #include <nlohmann/json.hpp>
 
@@ -6,8 +7,18 @@
 #include "cdb.h"
 #include "util.h"
 #include "paths.h"
+#include "collisions.h"
 
-bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialPaths) {
+void LogCollisions(const cdb::Manager& header, const std::vector<std::string>& materialPaths, const NameDictionary& names) {
+    const auto collisions = FindCollisions(materialPaths, header.GetDatabaseIds(), &names);
+    for (const auto& collision : collisions) {
+        Log("Resource id {} of {} collides with {}{}", GetFormatedResourceId(collision.id), collision.path,
+            collision.other, collision.database ? " in the database" : "");
+    }
+    Log("Found {} collisions in {} paths", collisions.size(), materialPaths.size());
+}
+
+bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialPaths, const NameDictionary& names, bool collisions) {
     cdb::Manager header;
     try {
         std::ifstream stream(dbPath, std::ios::in | std::ios::binary);
@@ -24,11 +35,16 @@ bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialP
         return false;
     }
 
+    if (collisions)
+        LogCollisions(header, materialPaths, names);
+
     nlohmann::json json;
     {
         std::unordered_map<BSResource::ID, const std::string&> resourceToPath;
-        for (const auto& path : materialPaths) {
-            resourceToPath.emplace(GetResourceIdFromPath(path), path);
+        const auto resourceIds = GetResourceIdsFromPaths(materialPaths);
+        resourceToPath.reserve(resourceIds.size());
+        for (size_t i = 0; i < resourceIds.size(); ++i) {
+            resourceToPath.emplace(resourceIds[i], materialPaths[i]);
         }
         std::map<uint16_t, std::string> typeMap;
         for (auto& [key, type] : header.fileIndex.ComponentTypes) {
@@ -38,8 +54,18 @@ bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialP
         auto& compiledDb = json["CompiledDB"];
         compiledDb["BuildVersion"] = header.database.BuildVersion;
         auto& hashMap = compiledDb["HashMap"];
+        std::vector<BSResource::ID> hashKeys;
+        hashKeys.reserve(header.database.HashMap.size());
+        for (auto& [key, value] : header.database.HashMap) {
+            hashKeys.emplace_back(key);
+        }
+        std::string hashText(hashKeys.size() * formatedResourceIdSize, '\0');
+        FormatResourceIds(hashKeys, hashText.data());
+        //Views into the formated text, the json builds its own strings from them
+        const std::string_view hashView(hashText);
+        size_t hashIdx = 0;
         for (auto& [key, value] : header.database.HashMap) {
-            hashMap[GetFormatedResourceId(key)] = std::to_string(value);
+            hashMap[hashView.substr(hashIdx++ * formatedResourceIdSize, formatedResourceIdSize)] = std::to_string(value);
         }
 
         auto& types = json["Types"];
@@ -55,9 +81,18 @@ bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialP
 
         //auto& objects = index["Objects"];
         auto& objects = json["Objects"];
+        std::string objectText(header.fileIndex.Objects.size() * formatedResourceIdSize, '\0');
+        {
+            char* out = objectText.data();
+            for (auto& object : header.fileIndex.Objects) {
+                out = FormatResourceId(object.PersistentID, out);
+            }
+        }
+        const std::string_view objectView(objectText);
+        size_t objectIdx = 0;
         for (auto& object : header.fileIndex.Objects) {
             auto& objectValue = objects.emplace_back();
-            objectValue["ResourceID"] = GetFormatedResourceId(object.PersistentID);
+            objectValue["ResourceID"] = objectView.substr(objectIdx++ * formatedResourceIdSize, formatedResourceIdSize);
             objectValue["DbID"] = object.DBID.Value;
             //objectValue["Parents"] = object.Parent.Value;
             //objectValue["HasData"] = object.HasData;
@@ -71,6 +106,8 @@ bool DumpDb(const std::string& dbPath, const std::vector<std::string>& materialP
             auto it = resourceToPath.find(object.PersistentID);
             if (it != resourceToPath.end())
                 objectValue["Path"] = it->second;
+            else if (const auto name = names.Find(object.PersistentID))
+                objectValue["Path"] = *name;
             else {
                 if (object.PersistentID.ext == 'tam') {
                     objectValue["Path"] = "<unknown>.mat";
@@ -128,8 +165,10 @@ void LogHelp(const char* exePath) {
         << "  " << exeName << " <path>.cdb - Manually specify the cdb path\n"
         << "\n"
         << "Options: \n"
-        << "  -help -h     Shows this help message\n"
-        << "  -nowait -nw  Disables the wait for user input on completion\n";
+        << "  -help -h       Shows this help message\n"
+        << "  -nowait -nw    Disables the wait for user input on completion\n"
+        << "  -rescan -rs    Scans archives, plugins and nif folders again instead of using ScanCache.dat\n"
+        << "  -collisions -c Reports paths whose resource ids collide with each other or the database\n";
 }
 
 int main(int argc, char** argv) {
@@ -137,7 +176,14 @@ int main(int argc, char** argv) {
     if (!GetPathInfo(paths, argc, argv))
         return -1;
 
-    DumpDb(paths.cdb, paths.materials);
+    bool collisions = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-collisions" || arg == "-c")
+            collisions = true;
+    }
+
+    DumpDb(paths.cdb, paths.materials, paths.names, collisions);
 
     if (!paths.noWait)
         auto _ = getchar();
@@ -1,19 +1,22 @@
 #include <filesystem>
 #include <fstream>
+#include <unordered_map>
 
 #include "util.h"
+#include "types.h"
 
 #include <nlohmann/json.hpp>
 #include <NifFile.hpp>
 
-bool AddSkeletonBones(const std::filesystem::path& inSkeleton, const std::filesystem::path& dstSkeleton, const std::filesystem::path& boneJsonPath) {
-	using namespace nifly;
+//A bone from bones.json with its global placement already derived, only the scale comes from the parent
+struct BoneSpec {
+	std::string name;
+	std::string parent;
+	nifly::MatTransform world;
+};
 
-	NifFile nif;
-	if (nif.Load(inSkeleton) != 0) {
-		Log("Failed to load skeleton {}", inSkeleton.string());
-		return false;
-	}
+bool ReadBoneSpecs(const std::filesystem::path& boneJsonPath, std::vector<BoneSpec>& specs) {
+	using namespace nifly;
 
 	nlohmann::json json;
 	{
@@ -58,46 +61,185 @@ bool AddSkeletonBones(const std::filesystem::path& inSkeleton, const std::filesy
 		}
 	};
 
-	Log("Adding bones to skeleton {}", inSkeleton.string());
-
-	for (auto& bone : json["bones"]) {
-		const std::string& nameStr = bone["name"];
-		const std::string& parentStr = bone["parent"];
+	specs.reserve(bones.size());
+	for (auto& bone : bones) {
 		const auto& head = bone["head"];
 		const auto& tail = bone["tail"];
-		const auto& roll = bone["roll"];
+		const float roll = bone["roll"];
 		const Vector3 headPos{ head[0], head[1], head[2] };
 		const Vector3 tailPos{ tail[0], tail[1], tail[2] };
-		NiNode* parent = nif.FindBlockByName<NiNode>(parentStr);
-		if (parent) {
-			MatTransform parentWorld;
-			nif.GetNodeTransformToGlobal(parentStr, parentWorld);
-			MatTransform nodeWorld;
-			nodeWorld.translation = headPos;
-			//nodeWorld.rotation = parentWorld.rotation;
-			constexpr float toRadian = PI / 180.0f;
-			nodeWorld.rotation.MakeRotation(roll * toRadian, 0.0f, 0.0f);
-			RotateTowards(nodeWorld, tailPos);
+		auto& spec = specs.emplace_back(bone["name"].get<std::string>(), bone["parent"].get<std::string>());
+		spec.world.translation = headPos;
+		constexpr float toRadian = PI / 180.0f;
+		spec.world.rotation.MakeRotation(roll * toRadian, 0.0f, 0.0f);
+		RotateTowards(spec.world, tailPos);
+	}
+	return true;
+}
+
+//Messages go to the report instead of the log, so skeletons extended in parallel don't interleave
+bool AddSkeletonBones(const std::filesystem::path& inSkeleton, const std::filesystem::path& dstSkeleton, const std::vector<BoneSpec>& bones, std::string& report) {
+	using namespace nifly;
+
+	const auto& Report = [&report]<typename... Args>(std::format_string<Args...> fmt, Args&&... args) {
+		report += std::format(fmt, std::forward<Args>(args)...);
+		report += '\n';
+	};
+
+	NifFile nif;
+	if (nif.Load(inSkeleton) != 0) {
+		Report("Failed to load skeleton {}", inSkeleton.string());
+		return false;
+	}
+
+	//Nodes by name with their global transform, so chained bones don't walk the block list and parent chain each time
+	struct NodeEntry {
+		NiNode* node = nullptr;
+		MatTransform world;
+		bool hasWorld = false;
+	};
+	std::unordered_map<std::string, NodeEntry> nodes;
+	for (auto node : nif.GetNodes()) {
+		nodes.try_emplace(node->name.get(), NodeEntry{ node });
+	}
+
+	Report("Adding bones to skeleton {}", inSkeleton.string());
+
+	for (const auto& bone : bones) {
+		const auto parentIt = nodes.find(bone.parent);
+		if (parentIt != nodes.end()) {
+			auto& parentEntry = parentIt->second;
+			if (!parentEntry.hasWorld) {
+				nif.GetNodeTransformToGlobal(bone.parent, parentEntry.world);
+				parentEntry.hasWorld = true;
+			}
+			const MatTransform parentWorld = parentEntry.world;
+			MatTransform nodeWorld = bone.world;
 			nodeWorld.scale = parentWorld.scale;
 			MatTransform nodeLocal = parentWorld.InverseTransform().ComposeTransforms(nodeWorld);
-			nif.AddNode(nameStr, nodeLocal, parent);
-			Log("Added {}", nameStr);
+			auto node = nif.AddNode(bone.name, nodeLocal, parentEntry.node);
+			nodes.try_emplace(bone.name, NodeEntry{ node, parentWorld.ComposeTransforms(nodeLocal), true });
+			Report("Added {}", bone.name);
 		}
 		else {
-			Log("Failed to find parent {} for bone {}", parentStr, nameStr);
+			Report("Failed to find parent {} for bone {}", bone.parent, bone.name);
 		}
 	}
 
 	CreateDirectories(dstSkeleton.string());
 	if (nif.Save(dstSkeleton) != 0) {
-		Log("Failed to save skeleton {}", dstSkeleton.string());
+		Report("Failed to save skeleton {}", dstSkeleton.string());
 		return false;
 	}
 
-	Log("Saved {}", dstSkeleton.string());
+	Report("Saved {}", dstSkeleton.string());
 	return true;
 }
 
+struct SkeletonJob {
+	std::filesystem::path inPath;
+	std::filesystem::path outPath;
+};
+
+//Skeletons from a folder keep their relative path, since creature skeletons all share the same file name
+int RunBatch(const std::vector<std::string>& inputs, const std::vector<std::string>& lists, const std::filesystem::path& jsonPath, const std::filesystem::path& outFolder) {
+	std::vector<BoneSpec> bones;
+	if (!ReadBoneSpecs(jsonPath, bones))
+		return 1;
+
+	std::vector<SkeletonJob> jobs;
+	const auto& AddFile = [&](const std::filesystem::path& path) {
+		jobs.emplace_back(path, std::filesystem::path(outFolder) / path.filename());
+	};
+	for (const auto& input : inputs) {
+		if (std::filesystem::is_directory(input)) {
+			std::error_code ec;
+			auto it = std::filesystem::recursive_directory_iterator(input, ec);
+			if (ec) {
+				Log("Error reading folder {} {}", input, ec.message());
+				continue;
+			}
+			for (const auto& entry : it) {
+				if (HasExtension(entry.path().native(), L".nif"))
+					jobs.emplace_back(entry.path(), std::filesystem::path(outFolder) / entry.path().lexically_relative(input));
+			}
+		}
+		else if (HasExtension(input, ".nif")) {
+			AddFile(input);
+		}
+	}
+	for (const auto& listPath : lists) {
+		std::ifstream list(listPath);
+		if (list.fail()) {
+			Log("Failed to open skeleton list {}", listPath);
+			return 1;
+		}
+		std::string line;
+		while (std::getline(list, line)) {
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (HasExtension(line, ".nif"))
+				AddFile(line);
+		}
+	}
+	if (jobs.empty()) {
+		Log("No skeletons found");
+		return 1;
+	}
+
+	//Files and list entries only keep their name, two of them with the same name would be written by several threads at once
+	PathMap<std::string, const SkeletonJob*> outPaths;
+	bool duplicates = false;
+	for (const auto& job : jobs) {
+		const auto [it, added] = outPaths.try_emplace(job.outPath.lexically_normal().string(), &job);
+		if (!added) {
+			Log("Skeletons {} and {} would both be written to {}", it->second->inPath.string(), job.inPath.string(), job.outPath.string());
+			duplicates = true;
+		}
+	}
+	if (duplicates) {
+		Log("Pass the skeletons' folders instead so they keep their relative path");
+		return 1;
+	}
+
+	Log("Adding {} bones to {} skeletons", bones.size(), jobs.size());
+	std::atomic<size_t> failed = 0;
+	std::mutex logLock;
+	ParallelFor(jobs.size(), [&](size_t i) {
+		std::string report;
+		bool added = false;
+		try {
+			added = AddSkeletonBones(jobs[i].inPath, jobs[i].outPath, bones, report);
+		}
+		catch (const std::exception& e) {
+			report += std::format("Error extending {} {}\n", jobs[i].inPath.string(), e.what());
+		}
+		failed += !added;
+		std::lock_guard lock(logLock);
+		std::cout << report;
+	});
+
+	Log("Extended {} of {} skeletons", jobs.size() - failed, jobs.size());
+	return failed ? 1 : 0;
+}
+
+void LogHelp(const char* exePath) {
+	const auto exeName = std::filesystem::path(exePath).filename().string();
+
+	std::cout << " --- " << exeName << " ---\n"
+		<< "\n"
+		<< "Adds the bones from res/bones.json to skeletons, drag nif files onto the exe to write them to Skeletons\n"
+		<< "\n"
+		<< "Usage: \n"
+		<< "  " << exeName << " <skeletons>.nif [bones].json\n"
+		<< "  " << exeName << " -batch [options] <skeletons or folders>\n"
+		<< "\n"
+		<< "Batch options: \n"
+		<< "  -batch -b         Extends all skeletons in parallel without waiting for input\n"
+		<< "  -list -l <path>   Reads skeleton paths from a text file, one per line\n"
+		<< "  -out -o <folder>  Output folder, skeletons from folders keep their relative path\n";
+}
+
 int main(int argc, char** argv) {
 	if (argc == 1) {
 		Log("Drag nif files onto this .exe to add bones from the bones.json");
@@ -107,21 +249,41 @@ int main(int argc, char** argv) {
 
 	const auto exePath = std::filesystem::path(argv[0]).remove_filename();
 	auto jsonPath = std::filesystem::path(exePath).append("res").append("bones.json");
+	auto outFolder = std::filesystem::path(exePath).append("Skeletons");
 
+	std::vector<std::string> inputs;
+	std::vector<std::string> lists;
+	bool batch = false;
 	for (int i = 1; i < argc; ++i) {
-		if (HasExtension(argv[i], ".json")) {
-			jsonPath = argv[i];
+		const std::string arg(argv[i]);
+		if (arg == "-batch" || arg == "-b")
+			batch = true;
+		else if ((arg == "-list" || arg == "-l") && i + 1 < argc)
+			lists.emplace_back(argv[++i]);
+		else if ((arg == "-out" || arg == "-o") && i + 1 < argc)
+			outFolder = argv[++i];
+		else if (arg == "-help" || arg == "-h") {
+			LogHelp(argv[0]);
+			return 0;
 		}
+		else if (HasExtension(arg, ".json"))
+			jsonPath = arg;
+		else
+			inputs.emplace_back(arg);
 	}
 
-	for (int i = 1; i < argc; ++i) {
-		const std::string inPath(argv[i]);
-		if (HasExtension(inPath, ".nif")) {
-			const std::string outPath = std::filesystem::path(exePath)
-				.append("Skeletons")
-				.append(std::filesystem::path(inPath).filename().native())
-				.string();
-			AddSkeletonBones(inPath, outPath, jsonPath);
+	if (batch)
+		return RunBatch(inputs, lists, jsonPath, outFolder);
+
+	std::vector<BoneSpec> bones;
+	if (ReadBoneSpecs(jsonPath, bones)) {
+		for (const auto& inPath : inputs) {
+			if (HasExtension(inPath, ".nif")) {
+				const auto outPath = std::filesystem::path(outFolder).append(std::filesystem::path(inPath).filename().native());
+				std::string report;
+				AddSkeletonBones(inPath, outPath, bones, report);
+				std::cout << report;
+			}
 		}
 	}
 	Log("Complete!");
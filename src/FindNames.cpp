@@ -0,0 +1,411 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cctype>
+#include <spanstream>
+#include <map>
+
+#include "bsa.h"
+#include "cdb.h"
+#include "crc.h"
+#include "mat.h"
+#include "names.h"
+#include "util.h"
+
+//Choices for each token of a pattern, every combination is one candidate
+using Tokens = std::vector<std::vector<std::string>>;
+using Matches = std::vector<std::pair<uint32_t, std::string>>;
+
+//Sorted crcs behind a bitmap of their high 24 bits, so most candidates are rejected with one load
+class CrcTargets {
+    std::vector<uint32_t> crcs;
+    std::vector<uint64_t> filter = std::vector<uint64_t>((1 << 24) / 64);
+
+public:
+    void Add(uint32_t crc) {
+        crcs.emplace_back(crc);
+        const uint32_t bit = crc >> 8;
+        filter[bit >> 6] |= 1ull << (bit & 63);
+    }
+
+    void Build() {
+        std::sort(crcs.begin(), crcs.end());
+        crcs.erase(std::unique(crcs.begin(), crcs.end()), crcs.end());
+    }
+
+    bool Contains(uint32_t crc) const {
+        const uint32_t bit = crc >> 8;
+        return (filter[bit >> 6] >> (bit & 63) & 1) && std::binary_search(crcs.begin(), crcs.end(), crc);
+    }
+
+    size_t Size() const { return crcs.size(); }
+};
+
+//{w} is any word, {d} a digit, {n} two digits, anything else is literal
+bool ParsePattern(const std::string& pattern, const std::vector<std::string>& words, Tokens& tokens) {
+    static const std::vector<std::string> digits = [] {
+        std::vector<std::string> result;
+        for (int i = 0; i < 10; ++i)
+            result.emplace_back(std::to_string(i));
+        return result;
+    }();
+    static const std::vector<std::string> numbers = [] {
+        std::vector<std::string> result;
+        for (int i = 0; i < 100; ++i)
+            result.emplace_back(std::format("{:02}", i));
+        return result;
+    }();
+
+    tokens.clear();
+    std::string literal;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] == '{' && i + 2 < pattern.size() && pattern[i + 2] == '}') {
+            const std::vector<std::string>* choices = nullptr;
+            switch (pattern[i + 1]) {
+            case 'w': choices = &words; break;
+            case 'd': choices = &digits; break;
+            case 'n': choices = &numbers; break;
+            default:
+                Log("Unknown pattern token {} in {}", pattern.substr(i, 3), pattern);
+                return false;
+            }
+            if (!literal.empty())
+                tokens.emplace_back(1, std::move(literal));
+            literal.clear();
+            tokens.emplace_back(*choices);
+            i += 2;
+        }
+        else {
+            literal += pattern[i];
+        }
+    }
+    if (!literal.empty())
+        tokens.emplace_back(1, std::move(literal));
+    return !tokens.empty();
+}
+
+//Depth first, so the crc of each prefix is computed once and continued for everything after it
+void Expand(const Tokens& tokens, size_t depth, uint32_t crc, std::string& text, const CrcTargets& targets, Matches& matches, uint64_t& count) {
+    const bool last = depth + 1 == tokens.size();
+    for (const auto& choice : tokens[depth]) {
+        const uint32_t next = ContinueCrc(crc, choice);
+        if (last) {
+            if (targets.Contains(next))
+                matches.emplace_back(next, text + choice);
+        }
+        else {
+            text += choice;
+            Expand(tokens, depth + 1, next, text, targets, matches, count);
+            text.resize(text.size() - choice.size());
+        }
+    }
+    if (last)
+        count += tokens[depth].size();
+}
+
+//The first two tokens are split across the worker pool
+Matches Search(const Tokens& tokens, const CrcTargets& targets, uint64_t& count) {
+    Matches result;
+    if (tokens.empty() || !targets.Size())
+        return result;
+
+    const size_t firstCount = tokens[0].size();
+    const size_t secondCount = tokens.size() > 1 ? tokens[1].size() : 1;
+    std::mutex resultLock;
+    std::atomic<uint64_t> total = 0;
+
+    ParallelFor(firstCount * secondCount, [&](size_t i) {
+        const auto& first = tokens[0][i / secondCount];
+        uint32_t crc = ContinueCrc(0, first);
+        std::string text(first);
+        Matches matches;
+        uint64_t localCount = 0;
+        if (tokens.size() == 1) {
+            localCount = 1;
+            if (targets.Contains(crc))
+                matches.emplace_back(crc, text);
+        }
+        else {
+            const auto& second = tokens[1][i % secondCount];
+            crc = ContinueCrc(crc, second);
+            text += second;
+            if (tokens.size() == 2) {
+                localCount = 1;
+                if (targets.Contains(crc))
+                    matches.emplace_back(crc, text);
+            }
+            else {
+                Expand(tokens, 2, crc, text, targets, matches, localCount);
+            }
+        }
+        total += localCount;
+        if (!matches.empty()) {
+            std::lock_guard lock(resultLock);
+            result.insert(result.end(), std::make_move_iterator(matches.begin()), std::make_move_iterator(matches.end()));
+        }
+    });
+
+    count += total;
+    return result;
+}
+
+//Lowercase runs of letters, digits are left to the {d} and {n} tokens
+void AddWords(std::vector<std::string>& words, std::string_view text) {
+    std::string word;
+    for (const char c : text) {
+        if (std::isalpha((uint8_t)c)) {
+            word += (char)std::tolower((uint8_t)c);
+        }
+        else if (!word.empty()) {
+            words.emplace_back(std::move(word));
+            word.clear();
+        }
+    }
+    if (!word.empty())
+        words.emplace_back(std::move(word));
+}
+
+bool ReadDatabaseHeader(const std::string& dbPath, cdb::Manager& header) {
+    std::vector<char> bytes;
+    if (HasExtension(dbPath, ".ba2")) {
+        if (!GetMaterialDatabase(dbPath, bytes)) {
+            Log("Failed to find material database in {}", dbPath);
+            return false;
+        }
+    }
+    else {
+        std::ifstream stream(dbPath, std::ios::in | std::ios::binary | std::ios::ate);
+        if (stream.fail()) {
+            Log("Failed to open material database {}", dbPath);
+            return false;
+        }
+        bytes.resize((size_t)stream.tellg());
+        stream.seekg(0);
+        stream.read(bytes.data(), bytes.size());
+    }
+
+    std::ispanstream stream(std::span{ bytes });
+    cdb::Reader in(stream);
+    return in.ReadHeader(header);
+}
+
+struct SearchOptions {
+    std::string dbPath;
+    std::string namesPath;
+    std::string outPath;
+    std::vector<std::string> wordPaths;
+    std::vector<std::string> patterns;
+    int depth = 1;
+};
+
+bool FindNames(const SearchOptions& options) {
+    using Clock = std::chrono::steady_clock;
+
+    cdb::Manager header;
+    if (!ReadDatabaseHeader(options.dbPath, header))
+        return false;
+
+    NameDictionary names;
+    if (!names.Load(options.namesPath))
+        return false;
+
+    std::vector<BSResource::ID> unresolved;
+    for (const auto& object : header.fileIndex.Objects) {
+        const auto& id = object.PersistentID;
+        if (id.ext == 'tam' && !names.Find(id) && std::find(rootMaterialIds.begin(), rootMaterialIds.end(), id) == rootMaterialIds.end())
+            unresolved.emplace_back(id);
+    }
+    Log("{} unnamed materials, {} known names", unresolved.size(), names.Size());
+    if (unresolved.empty())
+        return true;
+
+    //Known directories and the words used in known names
+    std::unordered_map<uint32_t, std::vector<std::string>> dirTexts;
+    std::vector<std::string> words;
+    names.ForEach([&](const BSResource::ID& id, const std::string& path) {
+        std::string_view dir, file;
+        size_t dotPos;
+        SplitResourcePath(path, dir, file, dotPos);
+        if (dir.size() != path.size()) {
+            auto& texts = dirTexts[id.dir];
+            if (texts.empty())
+                texts.emplace_back(dir);
+        }
+        AddWords(words, path);
+    });
+    for (const auto& wordPath : options.wordPaths) {
+        std::ifstream in(wordPath);
+        if (in.fail()) {
+            Log("Failed to open word list {}", wordPath);
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line))
+            AddWords(words, line);
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    Log("{} words, {} known directories", words.size(), dirTexts.size());
+
+    uint64_t candidates = 0;
+    const auto start = Clock::now();
+
+    //Directories one level below a known one, each round searches below the previous round's finds
+    {
+        CrcTargets dirTargets;
+        for (const auto& id : unresolved) {
+            if (!dirTexts.contains(id.dir))
+                dirTargets.Add(id.dir);
+        }
+        dirTargets.Build();
+
+        std::vector<std::string> bases;
+        for (const auto& [crc, texts] : dirTexts)
+            bases.insert(bases.end(), texts.begin(), texts.end());
+
+        for (int round = 0; round < options.depth && !bases.empty() && dirTargets.Size(); ++round) {
+            const Tokens tokens{ bases, { "\\" }, words };
+            const auto matches = Search(tokens, dirTargets, candidates);
+            bases.clear();
+            for (const auto& [crc, text] : matches) {
+                auto& texts = dirTexts[crc];
+                if (texts.size() < 16) {
+                    texts.emplace_back(text);
+                    bases.emplace_back(text);
+                }
+            }
+            Log("Directory round {} found {} candidates", round + 1, matches.size());
+        }
+    }
+
+    std::unordered_map<uint32_t, std::vector<std::string>> fileTexts;
+    {
+        CrcTargets fileTargets;
+        for (const auto& id : unresolved)
+            fileTargets.Add(id.file);
+        fileTargets.Build();
+
+        for (const auto& pattern : options.patterns) {
+            Tokens tokens;
+            if (!ParsePattern(pattern, words, tokens))
+                return false;
+            const auto matches = Search(tokens, fileTargets, candidates);
+            for (const auto& [crc, text] : matches) {
+                auto& texts = fileTexts[crc];
+                if (texts.size() < 16)
+                    texts.emplace_back(text);
+            }
+            Log("Pattern {} found {} candidates", pattern, matches.size());
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    Log("Tested {} candidates in {:.1f}s, {:.0f} per second", candidates, seconds, seconds > 0.0 ? candidates / seconds : 0.0);
+
+    //A name only counts when the whole path hashes back to the unresolved id
+    std::vector<std::string> found;
+    for (const auto& id : unresolved) {
+        const auto dirIt = dirTexts.find(id.dir);
+        const auto fileIt = fileTexts.find(id.file);
+        if (dirIt == dirTexts.end() || fileIt == fileTexts.end())
+            continue;
+        bool matched = false;
+        for (const auto& dir : dirIt->second) {
+            for (const auto& file : fileIt->second) {
+                auto path = std::format("{}\\{}.mat", dir, file);
+                if (GetResourceIdFromPath(path) == id) {
+                    found.emplace_back(std::move(path));
+                    matched = true;
+                    break;
+                }
+            }
+            if (matched)
+                break;
+        }
+    }
+
+    std::ofstream out(options.outPath, std::ios::out | std::ios::binary);
+    if (out.fail()) {
+        Log("Failed to write {}", options.outPath);
+        return false;
+    }
+    for (const auto& path : found)
+        out << path << "\n";
+
+    Log("Recovered {} of {} names, written to {}", found.size(), unresolved.size(), options.outPath);
+    return true;
+}
+
+void LogHelp(const char* exePath) {
+    const auto exeName = std::filesystem::path(exePath).filename().string();
+
+    std::cout << " --- " << exeName << " ---\n"
+        << "\n"
+        << "Searches for the paths of unnamed materials in the database by hashing generated candidates\n"
+        << "\n"
+        << "Usage: \n"
+        << "  " << exeName << " <path>.cdb [options]\n"
+        << "  " << exeName << " <path>.ba2 [options]\n"
+        << "\n"
+        << "Options: \n"
+        << "  -help -h              Shows this help message\n"
+        << "  -words -w <path>      Adds the words in a text file, words from known names are always used\n"
+        << "  -pattern -p <pattern> File name pattern, {w} is a word, {d} a digit and {n} two digits\n"
+        << "  -depth -d <count>     Directory levels to search below known directories, default 1\n"
+        << "  -names <path>         Name dictionary, default names_path in Settings.json or Names.dat next to the exe\n"
+        << "  -out -o <path>        Path list to write, default FoundNames.txt\n"
+        << "  -nowait -nw           Disables the wait for user input on completion\n";
+}
+
+int main(int argc, char** argv) {
+    const auto exeFolder = std::filesystem::path(argv[0]).remove_filename();
+    SearchOptions options{
+        .namesPath = GetNameDictionaryPath(exeFolder),
+        .outPath = "FoundNames.txt",
+    };
+    bool noWait = false;
+    bool help = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        const bool hasValue = i + 1 < argc;
+        if ((arg == "-words" || arg == "-w") && hasValue)
+            options.wordPaths.emplace_back(argv[++i]);
+        else if ((arg == "-pattern" || arg == "-p") && hasValue)
+            options.patterns.emplace_back(argv[++i]);
+        else if ((arg == "-depth" || arg == "-d") && hasValue)
+            options.depth = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "-names" && hasValue)
+            options.namesPath = argv[++i];
+        else if ((arg == "-out" || arg == "-o") && hasValue)
+            options.outPath = argv[++i];
+        else if (arg == "-nowait" || arg == "-nw")
+            noWait = true;
+        else if (arg == "-help" || arg == "-h")
+            help = true;
+        else
+            options.dbPath = arg;
+    }
+
+    if (help || options.dbPath.empty()) {
+        LogHelp(argv[0]);
+        if (!noWait)
+            auto _ = getchar();
+        return -1;
+    }
+
+    if (options.patterns.empty())
+        options.patterns = { "{w}", "{w}{w}", "{w}_{w}", "{w}{d}", "{w}{n}", "{w}_{n}" };
+
+    bool result = false;
+    try {
+        result = FindNames(options);
+    }
+    catch (const std::exception& e) {
+        Log("Error searching names {}", e.what());
+    }
+
+    if (!noWait)
+        auto _ = getchar();
+
+    return result ? 0 : 1;
+}
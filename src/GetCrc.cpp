@@ -1,7 +1,11 @@
 #include "util.h"
 #include "crc.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
 
 void LogCrc(const std::string& path) {
 	if (HasExtension(path, ".mat")) {
@@ -14,7 +18,198 @@ void LogCrc(const std::string& path) {
 	}
 }
 
+struct BatchOptions {
+	std::vector<std::string> inputs;
+	std::vector<std::string> lists;
+	std::string outPath;
+	bool stdinList = false;
+	bool jsonl = false;
+};
+
+//Paths under a folder are made relative to it, so an unpacked Data folder hashes like the archives
+void AddFolderPaths(std::vector<std::string>& paths, const std::string& folder) {
+	std::error_code ec;
+	auto it = std::filesystem::recursive_directory_iterator(folder, ec);
+	if (ec) {
+		std::cerr << std::format("Error reading folder {} {}\n", folder, ec.message());
+		return;
+	}
+	for (auto& entry : it) {
+		if (entry.is_regular_file(ec))
+			paths.emplace_back(entry.path().lexically_relative(folder).string());
+	}
+}
+
+void AddListPaths(std::vector<std::string>& paths, std::istream& in) {
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			paths.emplace_back(std::move(line));
+	}
+}
+
+void AppendEscaped(std::string& out, const std::string& path, bool jsonl) {
+	for (const char c : path) {
+		if (!jsonl) {
+			//Csv doubles quotes inside a quoted field
+			if (c == '"')
+				out += '"';
+			out += c;
+		}
+		else if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if ((uint8_t)c < 0x20) {
+			out += std::format("\\u{:04x}", (int)c);
+		}
+		else {
+			out += c;
+		}
+	}
+}
+
+//Hashes and formats one slice of the paths, each slice is written out in order
+void FormatCrcBatch(std::string& out, std::span<const std::string> paths, bool jsonl) {
+	const auto ids = GetResourceIdsFromPaths(paths);
+	char id[formatedResourceIdSize];
+	const auto& Field = [&id](size_t pos) { return std::string_view(id + pos, 8); };
+
+	out.reserve(paths.size() * 128);
+	for (size_t i = 0; i < paths.size(); ++i) {
+		FormatResourceId(ids[i], id);
+		if (jsonl) {
+			out += "{\"path\":\"";
+			AppendEscaped(out, paths[i], jsonl);
+			out += std::format("\",\"id\":\"{}\",\"dir\":\"{}\",\"file\":\"{}\",\"ext\":\"{}\"}}\n",
+				std::string_view(id, sizeof(id)), Field(4), Field(13), Field(22));
+		}
+		else {
+			out += '"';
+			AppendEscaped(out, paths[i], jsonl);
+			out += std::format("\",{},{},{},{}\n", std::string_view(id, sizeof(id)), Field(4), Field(13), Field(22));
+		}
+	}
+}
+
+int RunBatch(const BatchOptions& options) {
+	std::vector<std::string> paths;
+	for (const auto& input : options.inputs) {
+		if (std::filesystem::is_directory(input))
+			AddFolderPaths(paths, input);
+		else
+			paths.emplace_back(input);
+	}
+	for (const auto& listPath : options.lists) {
+		std::ifstream list(listPath);
+		if (list.fail()) {
+			std::cerr << std::format("Failed to open path list {}\n", listPath);
+			return 1;
+		}
+		AddListPaths(paths, list);
+	}
+	if (options.stdinList)
+		AddListPaths(paths, std::cin);
+
+	for (auto& path : paths) {
+		if (HasExtension(path, ".mat"))
+			SanitizePrefixedPath(path, "materials");
+	}
+
+	std::ofstream file;
+	if (!options.outPath.empty()) {
+		file.open(options.outPath, std::ios::out | std::ios::binary);
+		if (file.fail()) {
+			std::cerr << std::format("Failed to open output {}\n", options.outPath);
+			return 1;
+		}
+	}
+	std::ostream& out = options.outPath.empty() ? std::cout : file;
+
+	if (!options.jsonl)
+		out << "path,id,dir,file,ext\n";
+
+	//Batches are hashed in parallel and flushed in order, a few per thread at a time to bound memory
+	constexpr size_t batchSize = 0x4000;
+	const size_t batchCount = (paths.size() + batchSize - 1) / batchSize;
+	const size_t groupSize = GetThreadCount() * 4;
+	std::vector<std::string> outputs(groupSize);
+	for (size_t group = 0; group < batchCount; group += groupSize) {
+		const size_t count = std::min(groupSize, batchCount - group);
+		ParallelFor(count, [&](size_t i) {
+			const size_t begin = (group + i) * batchSize;
+			const size_t size = std::min(batchSize, paths.size() - begin);
+			outputs[i].clear();
+			FormatCrcBatch(outputs[i], { paths.data() + begin, size }, options.jsonl);
+		});
+		for (size_t i = 0; i < count; ++i) {
+			out.write(outputs[i].data(), outputs[i].size());
+		}
+	}
+	out.flush();
+
+	std::cerr << std::format("Hashed {} paths\n", paths.size());
+	return out.fail() ? 1 : 0;
+}
+
+void LogHelp(const char* exePath) {
+	const auto exeName = std::filesystem::path(exePath).filename().string();
+
+	std::cout << " --- " << exeName << " ---\n"
+		<< "\n"
+		<< "Logs the crc of each path, drag .mat files or folders onto the exe to get the MaterialID\n"
+		<< "\n"
+		<< "Usage: \n"
+		<< "  " << exeName << " <paths or folders>\n"
+		<< "  " << exeName << " -batch [options] <paths or folders>\n"
+		<< "\n"
+		<< "Batch options: \n"
+		<< "  -batch -b        Writes the full resource id of every path as csv, without waiting for input\n"
+		<< "  -list -l <path>  Reads paths from a text file, one per line\n"
+		<< "  -stdin -         Reads paths from standard input, one per line\n"
+		<< "  -jsonl -j        Writes json lines instead of csv\n"
+		<< "  -out -o <path>   Writes to a file instead of standard output\n"
+		<< "\n"
+		<< "Folder paths are written relative to the folder, so pass the Data folder to match the archives\n";
+}
+
 int main(int argc, char** argv) {
+	//Options are only parsed in batch mode, so dropped files named like one are still hashed
+	const bool batch = std::any_of(argv + 1, argv + argc, [](const char* arg) {
+		return std::string_view(arg) == "-batch" || std::string_view(arg) == "-b";
+	});
+	if (batch) {
+		BatchOptions options;
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg(argv[i]);
+			if (arg == "-batch" || arg == "-b")
+				continue;
+			else if ((arg == "-list" || arg == "-l") && i + 1 < argc)
+				options.lists.emplace_back(argv[++i]);
+			else if (arg == "-stdin" || arg == "-")
+				options.stdinList = true;
+			else if (arg == "-jsonl" || arg == "-j")
+				options.jsonl = true;
+			else if ((arg == "-out" || arg == "-o") && i + 1 < argc)
+				options.outPath = argv[++i];
+			else if (arg == "-help" || arg == "-h") {
+				LogHelp(argv[0]);
+				return 0;
+			}
+			else
+				options.inputs.emplace_back(arg);
+		}
+		try {
+			return RunBatch(options);
+		}
+		catch (const std::exception& e) {
+			std::cerr << std::format("{}\n", e.what());
+			return 1;
+		}
+	}
+
 	if (argc == 1) {
 		Log("Drag .mat files onto this .exe to get the MaterialID");
 	}
@@ -39,4 +234,4 @@ int main(int argc, char** argv) {
 	}
 	auto _ = getchar();
 	return 0;
-}
\ No newline at end of file
+}
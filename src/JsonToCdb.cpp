@@ -3,11 +3,14 @@
 #include <filesystem>
 #include <vector>
 #include <string>
+#include <unordered_set>
 
 #include "cdb.h"
 #include "util.h"
 #include "crc.h"
 #include "bs.h"
+#include "names.h"
+#include "collisions.h"
 
 bool GetMaterialPaths(const std::string& materialsFolder, std::vector<std::string>& paths) {
     std::error_code ec;
@@ -32,10 +35,177 @@ struct PathInfo {
     std::string materials;
     std::string cdbIn;
     std::string cdbOut;
+    std::string names;
     bool forceUpdate;
     bool test;
+    bool patch;
+    bool optimize;
+    bool collect;
 };
 
+//Finds the components of an existing material that differ from the database.
+//Components owned by the object are replaced, inherited components are appended to the object
+bool GetMaterialUpdates(const cdb::Manager& header, nlohmann::json& matJson, const BSComponentDB2::ID matId,
+    std::unordered_map<uint32_t, nlohmann::json>& updates, std::vector<cdb::Writer::UpdateInfo>& appends)
+{
+    bool anyUpdated = false;
+    auto& objects = matJson["Objects"];
+    for (size_t i = 0; i < objects.size(); ++i) {
+        auto& object = objects[i];
+        BSComponentDB2::ID objectId = matId;
+        if (i != 0) {
+            const std::string& idString = object["ID"];
+            objectId = header.GetObjectId(idString);
+            if (!objectId.Value) {
+                Log("Object not found for id {}", idString);
+                continue;
+            }
+        }
+
+        nlohmann::json dbObject;
+        header.GetFullJson(objectId, dbObject);
+        const auto& dbComponents = dbObject["Components"];
+
+        for (auto& component : object["Components"]) {
+            header.ResolveReferencedIds(component);
+            const std::string& typeName = component["Type"];
+            const uint32_t index = component["Index"];
+
+            auto dbIt = std::find_if(dbComponents.begin(), dbComponents.end(), [&](const nlohmann::json& dbComponent) {
+                return dbComponent["Index"] == index && _stricmp(dbComponent["Type"].get_ref<const std::string&>().c_str(), typeName.c_str()) == 0;
+            });
+            if (dbIt != dbComponents.end() && header.CompareJsons(component, *dbIt))
+                continue;
+
+            anyUpdated = true;
+            const auto& refs = header.GetComponents(objectId);
+            auto refIt = std::find_if(refs.begin(), refs.end(), [&](const cdb::Manager::ComponentRef& ref) {
+                return ref.component.Index == index && _stricmp(header.GetType(ref.component.Type).Class.c_str(), typeName.c_str()) == 0;
+            });
+            if (refIt != refs.end())
+                updates[refIt->idx] = component;
+            else
+                appends.emplace_back(component, objectId);
+        }
+    }
+    return anyUpdated;
+}
+
+//Lays out the output file in two passes. New and changed components are serialized in parallel,
+//untouched components are copied from the original file by offset
+bool WriteDatabaseLayout(const PathInfo& paths, const cdb::Manager& header, const std::unordered_map<uint32_t, nlohmann::json>& updates,
+    const std::vector<cdb::Writer::UpdateInfo>& appends, const std::vector<cdb::Writer::CreateInfo>& creates)
+{
+    using namespace cdb;
+
+    std::ifstream stream(paths.cdbIn, std::ios::in | std::ios::binary);
+    if (stream.fail()) {
+        Log("Failed to open cdb file again {}", paths.cdbIn);
+        return false;
+    }
+
+    Reader in(stream);
+    in.ReadHeader();
+
+    const Writer::Header outHeader{
+        in.Version(),
+        0,
+        in.StringTable(),
+        in.Classes(),
+    };
+
+    Layout layout(outHeader);
+    for (uint32_t i = 0; i < header.fileIndex.Components.size(); ++i) {
+        auto updateIt = updates.find(i);
+        if (updateIt != updates.end())
+            layout.AddJson(updateIt->second);
+        else
+            layout.AddCopy(header.posMap[i], header.posMap[i + 1], header.chunkCounts[i]);
+    }
+    for (auto& info : appends) {
+        layout.AddJson(info.json);
+    }
+    for (auto& createInfo : creates) {
+        auto& objects = createInfo.json["Objects"];
+        for (auto& object : objects) {
+            auto& components = object["Components"];
+            for (auto& component : components) {
+                layout.AddJson(component);
+            }
+        }
+    }
+
+    Log("Recompiling database");
+    try {
+        layout.Serialize();
+        layout.Plan([&](Writer& out) {
+            out.WriteDatabase(header, creates, appends);
+        });
+    }
+    catch (const std::exception& e) {
+        Log("Error serializing components {}", e.what());
+        return false;
+    }
+
+    if (!layout.Write(paths.cdbOut, paths.cdbIn)) {
+        Log("Failed to write .cdb file {}", paths.cdbOut);
+        return false;
+    }
+
+    Log("Recompiled database written to {}", paths.cdbOut);
+    return true;
+}
+
+//Rewrites a compiled database in place with dense ids and each material's objects stored together.
+//When collecting, objects unreachable from any .mat are dropped with their components and edges
+bool OptimizeDatabase(const std::string& cdbPath, bool collect) {
+    using namespace cdb;
+
+    {
+        std::ifstream stream(cdbPath, std::ios::in | std::ios::binary);
+        if (stream.fail()) {
+            Log("Failed to open cdb file {}", cdbPath);
+            return false;
+        }
+
+        Reader in(stream);
+        Manager header;
+        if (!in.ReadHeader(header))
+            return false;
+
+        if (!in.ReadAllComponents(header)) {
+            Log("Error reading material component diffs {}", cdbPath);
+            return false;
+        }
+
+        Log("Optimizing database layout");
+        Optimizer optimizer(header);
+        if (collect) {
+            const auto unreachable = optimizer.Collect();
+            Log("Dropping {} unreachable objects", unreachable);
+        }
+        optimizer.Order();
+
+        const Writer::Header outHeader{
+            in.Version(),
+            0,
+            in.StringTable(),
+            in.Classes(),
+        };
+
+        //Layout::Write replaces the file through its own temporary, the source only has to be closed first
+        stream.close();
+        if (!optimizer.Write(outHeader, cdbPath, cdbPath)) {
+            Log("Failed to write .cdb file {}", cdbPath);
+            return false;
+        }
+        Log("Renumbered {} objects, next id {} -> {}", header.fileIndex.Objects.size(), header.nextObjectId, optimizer.Index().Objects.size() + 1);
+    }
+
+    Log("Optimized database written to {}", cdbPath);
+    return true;
+}
+
 bool RecompileDatabase(const PathInfo& paths) {
     using namespace cdb;
 
@@ -73,6 +243,19 @@ bool RecompileDatabase(const PathInfo& paths) {
         }
     }
 
+    //A material sharing an id with another path would overwrite it in the database
+    NameDictionary names;
+    names.Load(paths.names);
+    const auto collisions = FindCollisions(materialPaths, header.GetDatabaseIds(), &names);
+    if (!collisions.empty()) {
+        for (const auto& collision : collisions) {
+            Log("Resource id {} of {} collides with {}{}", GetFormatedResourceId(collision.id), collision.path,
+                collision.other, collision.database ? " in the database" : "");
+        }
+        Log("Aborting, rename the colliding materials");
+        return false;
+    }
+
     //TestStruct tester;
     //tester.hash = 56916906640545u;
     //tester.resourceId = GetResourceIdFromPath("materials\\actors\\human\\faces\\female_default.mat");
@@ -80,8 +263,17 @@ bool RecompileDatabase(const PathInfo& paths) {
     //tester.matId = testerIt != header.resourceToDb.end() ? testerIt->second : BSComponentDB2::ID{ 0 };
     //header.GetComponentIndexesForMaterial(tester.matId, tester);
 
+    //Hash map ids of entries that aren't objects, so new materials can't take them
+    std::unordered_set<BSResource::ID> hashMapIds;
+    hashMapIds.reserve(header.database.HashMap.size());
+    for (const auto& [id, hash] : header.database.HashMap) {
+        hashMapIds.emplace(id);
+    }
+
     bool anyUpdated = false;
+    size_t unnamedMatches = 0;
     std::unordered_map<uint32_t, nlohmann::json> updates;
+    std::vector<Writer::UpdateInfo> appends;
     std::vector<Writer::CreateInfo> creates;
     Log("Checking for updated materials");
 
@@ -102,8 +294,20 @@ bool RecompileDatabase(const PathInfo& paths) {
         auto pathIt = header.resourceToDb.find(matResourceId);
         auto matDbid = pathIt != header.resourceToDb.end() ? pathIt->second : BSComponentDB2::ID{ 0 };
 
+        //Without a known name the entry could be a different material that only shares the id
+        if (matDbid.Value && !names.Find(matResourceId)) {
+            Log("Material {} has the same resource id {} as an unnamed database entry, it is treated as the same material", matPath, GetFormatedResourceId(matResourceId));
+            unnamedMatches++;
+        }
+
         //Existing
-        if (matDbid.Value) {
+        if (matDbid.Value && paths.patch) {
+            if (GetMaterialUpdates(header, matJson, matDbid, updates, appends)) {
+                anyUpdated = true;
+                Log("Existing material updated {}", matPath);
+            }
+        }
+        else if (matDbid.Value) {
             nlohmann::json dbJson;
             //TODO fix idToPath map
             header.CreateMaterialJson(dbJson, matDbid, {});
@@ -119,6 +323,10 @@ bool RecompileDatabase(const PathInfo& paths) {
         }
         //New
         else {
+            if (hashMapIds.contains(matResourceId)) {
+                Log("New material {} has the same resource id {} as an existing hash map entry", matPath, GetFormatedResourceId(matResourceId));
+                return false;
+            }
             header.UpdateDatabaseIds(matJson, matPath);
             //TODO GET HASH
             //creates.emplace_back(std::move(matJson), matResourceId, GetHashFromBSResourceId(matResourceId));
@@ -128,121 +336,49 @@ bool RecompileDatabase(const PathInfo& paths) {
         }
     }
 
+    if (unnamedMatches)
+        Log("{} materials matched unnamed database entries, check them against the game's files", unnamedMatches);
+
     if (!paths.forceUpdate && !anyUpdated) {
         Log("No new or updated materials found.");
         return false;
     }
 
-    {
-        std::ofstream outStream(paths.cdbOut, std::ios::out | std::ios::binary);
-        if (outStream.fail()) {
-            Log("Failed to create .cdb file {}", paths.cdbOut);
-            return false;
-        }
-
-        std::ifstream stream(paths.cdbIn, std::ios::in | std::ios::binary);
-        if (stream.fail()) {
-            Log("Failed to open cdb file again {}", paths.cdbIn);
-            return false;
-        }
-
-        //Log("Reading material database {}", cdbIn);
-        Reader in(stream);
-        in.ReadHeader();
-        in.SkipNextObject();
-        in.SkipNextObject();
-
-        Log("Recompiling database");
-
-        //uint32_t chunkSize = in.ChunkSize();
-        //for (auto& createInfo : creates) {
-        //    auto& objects = createInfo.json["Objects"];
-        //    for (auto& object : objects) {
-        //        auto& components = object["Components"];
-        //        for (auto& component : components) {
-        //            //Objt
-        //            chunkSize++;
-        //            in.GetJsonChunkCount(component, chunkSize);
-        //        }
-        //    }
-        //}
-
-        //uint32_t chunkSize = uint32_t(in.HeaderChunkSize());
-        //for (auto& componentIdx : tester.componentSet) {
-        //    const auto& component = header.componentJsons.at(componentIdx);
-        //    chunkSize++;
-        //    in.GetJsonChunkCount(component, chunkSize);
-        //}
-
-        Writer::Header outHeader{
-            in.Version(),
-            chunkSize,
-            in.StringTable(),
-            in.Classes(),
-        };
-
-        Writer out(outStream, outHeader);
-        out.WriteHeader();
-        if (!paths.test) {
-            out.WriteDatabase(header, creates);
-            for (uint32_t i = 0; i < header.fileIndex.Components.size(); ++i) {
-                //auto updateIt = updates.find(i);
-                //if (updateIt != updates.end()) {
-                //    //out.WriteComponentJson();
-                //}
-                //else {
-                //    out.WriteChunk(in);
-                //}
-                out.WriteChunk(in);
-            }
-            for (auto& createInfo : creates) {
-                auto& objects = createInfo.json["Objects"];
-                for (auto& object : objects) {
-                    auto& components = object["Components"];
-                    for (auto& component : components) {
-                        out.WriteComponentJson(component);
-                    }
-                }
-            }
-        }
-        else {
-            //out.WriteTestDatabase(header, tester);
-            //for (uint32_t i = 0; i < header.fileIndex.Components.size(); ++i) {
-            //    if (tester.componentSet.contains(i))
-            //        out.WriteChunk(in);
-            //    else
-            //        in.SkipNextObject();
-            //}
-
-            //nlohmann::json testdump;
-            //for (auto& componentIdx : tester.componentSet) {
-            //    testdump.emplace_back() = header.componentJsons.at(componentIdx);
-            //}
-
-            //std::ofstream teststream("testdump.json", std::ios::out | std::ios::binary);
-            //if (teststream.fail())
-            //    Log("lol");
-            //teststream << testdump.dump(2);
-        }
-    }
-
-    Log("Recompiled database written to {}", paths.cdbOut);
-    return true;
+    return WriteDatabaseLayout(paths, header, updates, appends, creates);
 }
 
 int main(int argc, char** argv) {
     const auto materialsFolder = std::filesystem::path(argv[0]).remove_filename().append("Materials");
 
+    bool patch = false;
+    bool optimize = false;
+    bool collect = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-patch" || arg == "-p")
+            patch = true;
+        else if (arg == "-optimize" || arg == "-o")
+            optimize = true;
+        else if (arg == "-gc")
+            collect = true;
+    }
+
     const PathInfo paths{
         .materials = materialsFolder.string(),
         .cdbIn = std::filesystem::path(materialsFolder).append("materialsbeta_original.cdb").string(),
         //.cdbOut = std::filesystem::path(materialsFolder).append("materialsbeta.cdb").string(),
         .cdbOut = std::filesystem::path(materialsFolder).append("materialsbeta_test.cdb").string(),
+        .names = GetNameDictionaryPath(std::filesystem::path(argv[0]).remove_filename()),
         .forceUpdate = true,
         //.test = true,
+        .patch = patch,
+        .optimize = optimize,
+        .collect = collect,
     };
 
     if (!RecompileDatabase(paths))
         return -1;
+    if ((paths.optimize || paths.collect) && !OptimizeDatabase(paths.cdbOut, paths.collect))
+        return -1;
     return 0;
 }
\ No newline at end of file
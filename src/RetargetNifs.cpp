@@ -0,0 +1,204 @@
+#include <filesystem>
+#include <fstream>
+
+#include "util.h"
+#include "types.h"
+#include "nif.h"
+
+//Whole paths map one material, paths ending in a slash move everything below that folder
+struct RetargetMap {
+    PathMap<std::string, std::string> files;
+    PathMap<std::string, std::string> folders;
+
+    bool Retarget(std::string& path) const {
+        std::string key(path);
+        SanitizePrefixedPath(key, "materials");
+        if (const auto it = files.find(key); it != files.end()) {
+            path = it->second;
+            return true;
+        }
+        //Deepest folder first, so a mapping for a subfolder wins over its parent
+        for (auto pos = key.find_last_of('\\'); pos != std::string::npos && pos > 0; pos = key.find_last_of('\\', pos - 1)) {
+            if (const auto it = folders.find(key.substr(0, pos)); it != folders.end()) {
+                path = it->second + key.substr(pos);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+bool ReadRetargetMap(RetargetMap& map, const std::string& path) {
+    std::ifstream in(path);
+    if (in.fail()) {
+        Log("Failed to open mapping {}", path);
+        return false;
+    }
+    std::string line;
+    size_t lineIndex = 0;
+    while (std::getline(in, line)) {
+        ++lineIndex;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line.front() == '#')
+            continue;
+        const auto split = line.find(',');
+        if (split == 0 || split == std::string::npos || split + 1 == line.size()) {
+            Log("Skipping line {} of {}, expected <from>,<to>", lineIndex, path);
+            continue;
+        }
+        std::string from = line.substr(0, split);
+        std::string to = line.substr(split + 1);
+        SanitizePrefixedPath(from, "materials");
+        SanitizePrefixedPath(to, "materials");
+        if (from.back() == '\\') {
+            from.pop_back();
+            if (to.back() == '\\')
+                to.pop_back();
+            map.folders.insert_or_assign(std::move(from), std::move(to));
+        }
+        else {
+            map.files.insert_or_assign(std::move(from), std::move(to));
+        }
+    }
+    Log("Read {} material and {} folder mappings from {}", map.files.size(), map.folders.size(), path);
+    return true;
+}
+
+struct RetargetJob {
+    std::filesystem::path path;
+    std::filesystem::path outPath;
+};
+
+bool RetargetNifs(const RetargetMap& map, const std::vector<std::string>& inputs, const std::string& outFolder) {
+    //With an output folder the meshes keep their path relative to the input folder, otherwise they're replaced in place
+    std::vector<RetargetJob> jobs;
+    const auto& AddJob = [&](const std::filesystem::path& path, const std::filesystem::path& relative) {
+        jobs.emplace_back(path, outFolder.empty() ? path : std::filesystem::path(outFolder) / relative);
+    };
+    for (const auto& input : inputs) {
+        if (std::filesystem::is_directory(input)) {
+            std::error_code ec;
+            auto it = std::filesystem::recursive_directory_iterator(input, ec);
+            if (ec) {
+                Log("Error reading folder {} {}", input, ec.message());
+                continue;
+            }
+            for (const auto& entry : it) {
+                if (HasExtension(entry.path().native(), L".nif"))
+                    AddJob(entry.path(), entry.path().lexically_relative(input));
+            }
+        }
+        else if (HasExtension(input, ".nif")) {
+            AddJob(input, std::filesystem::path(input).filename());
+        }
+    }
+    if (jobs.empty()) {
+        Log("No .nif files found");
+        return false;
+    }
+    Log("Retargeting {} .nif files", jobs.size());
+
+    struct Worker {
+        std::vector<char> buffer;
+        size_t files = 0;
+        size_t names = 0;
+        std::vector<std::string> failed;
+    };
+    std::vector<Worker> workers(GetWorkerCount(jobs.size()));
+    const NifStringRetarget retarget = [&map](std::string& path) {
+        return map.Retarget(path);
+    };
+    ParallelForWorker(jobs.size(), [&](size_t w, size_t i) {
+        auto& worker = workers[w];
+        size_t changed = 0;
+        bool retargeted = false;
+        try {
+            retargeted = RetargetNifMaterials(jobs[i].path, jobs[i].outPath, retarget, changed, worker.buffer);
+        }
+        catch (...) {}
+        if (!retargeted) {
+            worker.failed.emplace_back(jobs[i].path.string());
+            return;
+        }
+        worker.files += changed != 0;
+        worker.names += changed;
+    });
+
+    size_t files = 0, names = 0, failed = 0;
+    for (const auto& worker : workers) {
+        files += worker.files;
+        names += worker.names;
+        failed += worker.failed.size();
+        for (const auto& path : worker.failed)
+            Log("Failed to retarget {}", path);
+    }
+    Log("Retargeted {} materials in {} of {} .nif files, {} failed", names, files, jobs.size(), failed);
+    return failed == 0;
+}
+
+void LogHelp(const char* exePath) {
+    const auto exeName = std::filesystem::path(exePath).filename().string();
+
+    std::cout << " --- " << exeName << " ---\n"
+        << "\n"
+        << "Rewrites the .mat paths referenced by nif files using a mapping file\n"
+        << "\n"
+        << "Usage: \n"
+        << "  " << exeName << " -map <path> [options] <nif files or folders>\n"
+        << "\n"
+        << "Mapping: \n"
+        << "  One <from>,<to> pair per line, lines starting with # are skipped\n"
+        << "  Paths ending in a slash move every material below that folder\n"
+        << "\n"
+        << "Options: \n"
+        << "  -help -h         Shows this help message\n"
+        << "  -map -m <path>   Mapping file\n"
+        << "  -out -o <folder> Writes changed nifs to a folder instead of replacing them\n"
+        << "  -nowait -nw      Disables the wait for user input on completion\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> inputs;
+    std::string mapPath;
+    std::string outFolder;
+    bool noWait = false;
+    bool help = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        const bool hasValue = i + 1 < argc;
+        if ((arg == "-map" || arg == "-m") && hasValue)
+            mapPath = argv[++i];
+        else if ((arg == "-out" || arg == "-o") && hasValue)
+            outFolder = argv[++i];
+        else if (arg == "-nowait" || arg == "-nw")
+            noWait = true;
+        else if (arg == "-help" || arg == "-h")
+            help = true;
+        else
+            inputs.emplace_back(arg);
+    }
+
+    if (help || mapPath.empty() || inputs.empty()) {
+        LogHelp(argv[0]);
+        if (!noWait)
+            auto _ = getchar();
+        return -1;
+    }
+
+    bool result = false;
+    RetargetMap map;
+    if (ReadRetargetMap(map, mapPath)) {
+        try {
+            result = RetargetNifs(map, inputs, outFolder);
+        }
+        catch (const std::exception& e) {
+            Log("Error retargeting nifs {}", e.what());
+        }
+    }
+
+    if (!noWait)
+        auto _ = getchar();
+
+    return result ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+#include <iostream>
+#include <chrono>
+#include <spanstream>
+#include <sstream>
+
+#include <nlohmann/json.hpp>
+
+#include "bsa.h"
+#include "cdb.h"
+#include "util.h"
+
+class PhaseTimer {
+    using Clock = std::chrono::steady_clock;
+
+    const char* name;
+    Clock::time_point start = Clock::now();
+
+public:
+    PhaseTimer(const char* _name) : name(_name) {}
+
+    void End(size_t bytes) const {
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const double mbps = seconds > 0.0 ? (double)bytes / seconds / (1024.0 * 1024.0) : 0.0;
+        Log("{:<24} {:>10} bytes {:>9.3f}s {:>10.1f} MB/s", name, bytes, seconds, mbps);
+    }
+};
+
+void LogBytes(const char* label, const char* data, size_t size, size_t begin, size_t end) {
+    end = std::min(end, size);
+    std::string line;
+    for (size_t i = begin; i < end; ++i) {
+        line += std::format("{:02X} ", (uint8_t)data[i]);
+    }
+    Log("  {}: {:08X}: {}", label, begin, line);
+}
+
+//Reports the first differing byte with the chunk and component it belongs to
+void LogDivergence(const std::vector<char>& src, const std::string& dst, const cdb::Manager& header, uint32_t headerChunks) {
+    const size_t minSize = std::min(src.size(), dst.size());
+    const auto [srcIt, dstIt] = std::mismatch(src.begin(), src.begin() + minSize, dst.begin());
+    const size_t pos = srcIt - src.begin();
+
+    if (pos == minSize && src.size() == dst.size()) {
+        Log("Round trip is byte exact, {} bytes", src.size());
+        return;
+    }
+
+    Log("First divergence at {:08X}, input {} bytes, output {} bytes", pos, src.size(), dst.size());
+
+    size_t chunkPos = 0;
+    uint32_t chunkIdx = 0;
+    cdb::Chunk chunk{};
+    while (chunkPos + sizeof(cdb::Chunk) <= src.size()) {
+        std::memcpy(&chunk, src.data() + chunkPos, sizeof(cdb::Chunk));
+        const size_t chunkEnd = chunkPos + sizeof(cdb::Chunk) + chunk.size;
+        if (pos < chunkEnd)
+            break;
+        chunkPos = chunkEnd;
+        chunkIdx++;
+    }
+    Log("  Chunk {} {} at {:08X}, size {:X}, offset {:X} into the chunk", chunkIdx, chunk.GetSig(), chunkPos, chunk.size, pos - chunkPos);
+
+    if (chunkIdx < headerChunks) {
+        Log("  In the header");
+    }
+    else if (header.posMap.empty() || pos < header.posMap.front()) {
+        Log("  In the index tables");
+    }
+    else {
+        const auto posIt = std::upper_bound(header.posMap.begin(), header.posMap.end(), (uint32_t)pos);
+        const size_t idx = (posIt - header.posMap.begin()) - 1;
+        if (idx < header.fileIndex.Components.size()) {
+            const auto& component = header.fileIndex.Components[idx];
+            Log("  In component {} {} of object {}, index {}{}", idx, header.GetType(component.Type).Class,
+                component.ObjectID.Value, component.Index, header.componentDiffs[idx] ? " (diff)" : "");
+        }
+    }
+
+    const size_t begin = pos > 8 ? pos - 8 : 0;
+    LogBytes("Input ", src.data(), src.size(), begin, pos + 8);
+    LogBytes("Output", dst.data(), dst.size(), begin, pos + 8);
+}
+
+bool VerifyDb(const std::string& cdbPath, bool save) {
+    using namespace cdb;
+
+    std::vector<char> bytes;
+    {
+        PhaseTimer timer("Load");
+        if (HasExtension(cdbPath, ".ba2")) {
+            if (!GetMaterialDatabase(cdbPath, bytes)) {
+                Log("Failed to find material database in {}", cdbPath);
+                return false;
+            }
+        }
+        else {
+            std::ifstream stream(cdbPath, std::ios::in | std::ios::binary | std::ios::ate);
+            if (stream.fail()) {
+                Log("Failed to open material database {}", cdbPath);
+                return false;
+            }
+            bytes.resize((size_t)stream.tellg());
+            stream.seekg(0);
+            stream.read(bytes.data(), bytes.size());
+        }
+        timer.End(bytes.size());
+    }
+
+    std::ispanstream stream(std::span{ bytes });
+    Reader in(stream);
+    Manager header;
+    {
+        PhaseTimer timer("ReadHeader");
+        if (!in.ReadHeader(header))
+            return false;
+        timer.End(in.Pos());
+    }
+    {
+        const size_t begin = in.Pos();
+        PhaseTimer timer("ReadAllComponents");
+        if (!in.ReadAllComponents(header)) {
+            Log("Error reading material component diffs {}", cdbPath);
+            return false;
+        }
+        timer.End(bytes.size() - begin);
+    }
+
+    const Writer::Header outHeader{
+        in.Version(),
+        in.ChunkSize(),
+        in.StringTable(),
+        in.Classes(),
+    };
+
+    std::ostringstream outStream(std::ios::out | std::ios::binary);
+    try {
+        Writer out(outStream, outHeader);
+        {
+            PhaseTimer timer("WriteDatabase");
+            out.WriteHeader();
+            out.WriteDatabase(header, {});
+            timer.End((size_t)outStream.tellp());
+        }
+        {
+            const size_t begin = (size_t)outStream.tellp();
+            PhaseTimer timer("WriteComponentJson");
+            for (size_t i = 0; i < header.componentJsons.size(); ++i) {
+                out.WriteComponentJson(header.componentJsons[i], header.componentDiffs[i]);
+            }
+            timer.End((size_t)outStream.tellp() - begin);
+        }
+    }
+    catch (const std::exception& e) {
+        Log("Error writing database {}", e.what());
+        return false;
+    }
+
+    const auto output = std::move(outStream).str();
+    {
+        PhaseTimer timer("Compare");
+        LogDivergence(bytes, output, header, in.HeaderChunkSize());
+        timer.End(bytes.size());
+    }
+
+    if (save) {
+        const auto outPath = std::filesystem::path(cdbPath).replace_extension(".roundtrip.cdb").string();
+        std::ofstream out(outPath, std::ios::out | std::ios::binary);
+        if (out.fail()) {
+            Log("Failed to write {}", outPath);
+            return false;
+        }
+        out.write(output.data(), output.size());
+        Log("Round trip written to {}", outPath);
+    }
+
+    return bytes.size() == output.size() && std::equal(bytes.begin(), bytes.end(), output.begin());
+}
+
+void LogHelp(const char* exePath) {
+    const auto exeName = std::filesystem::path(exePath).filename().string();
+
+    std::cout << " --- " << exeName << " ---\n"
+        << "\n"
+        << "Reads a material database and writes it back from the decoded json, then compares the result byte for byte\n"
+        << "\n"
+        << "Usage: \n"
+        << "  " << exeName << " <path>.cdb - Verifies the cdb file\n"
+        << "  " << exeName << " <path>.ba2 - Verifies the cdb inside the material archive\n"
+        << "\n"
+        << "Options: \n"
+        << "  -help -h     Shows this help message\n"
+        << "  -save -s     Writes the re-encoded database next to the input\n"
+        << "  -nowait -nw  Disables the wait for user input on completion\n";
+}
+
+int main(int argc, char** argv) {
+    std::string cdbPath;
+    bool save = false;
+    bool noWait = false;
+    bool help = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-save" || arg == "-s")
+            save = true;
+        else if (arg == "-nowait" || arg == "-nw")
+            noWait = true;
+        else if (arg == "-help" || arg == "-h")
+            help = true;
+        else
+            cdbPath = arg;
+    }
+
+    if (help || cdbPath.empty()) {
+        LogHelp(argv[0]);
+        if (!noWait)
+            auto _ = getchar();
+        return -1;
+    }
+
+    const bool exact = VerifyDb(cdbPath, save);
+
+    if (!noWait)
+        auto _ = getchar();
+
+    return exact ? 0 : 1;
+}
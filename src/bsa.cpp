@@ -1,10 +1,12 @@
 #include "bsa.h"
 
 #include <bsa/fo4.hpp>
+#include <miniz/miniz.h>
 
 #include <string_view>
 #include <span>
 #include <spanstream>
+#include <algorithm>
 
 #include "util.h"
 #include "crc.h"
@@ -22,21 +24,107 @@ bool GetMaterialDatabase(const std::string& path, std::vector<char>& bytes) {
 	return true;
 }
 
-bool GetMaterialPathsFromBsa(PathSet& pathSet, const std::string& path) {
+//Inflates the chunk a block at a time until the consumer returns true, so only the front of large meshes is decompressed
+//Returns false when the chunk ended or couldn't be read before the consumer was satisfied
+template<class Consumer>
+bool DecompressPrefix(const bsa::fo4::chunk& chunk, bsa::fo4::compression_format format, std::vector<char>& buffer, const Consumer& consumer) {
+	const auto bytes = chunk.as_bytes();
+	if (!chunk.compressed())
+		return consumer(std::span<const char>((const char*)bytes.data(), bytes.size()));
+	//Only zlib streams can be inflated partially here
+	if (format != bsa::fo4::compression_format::zip)
+		return false;
+
+	constexpr size_t initialSize = 0x4000;
+	const size_t size = chunk.decompressed_size();
+	z_stream stream{};
+	stream.next_in = (const unsigned char*)bytes.data();
+	stream.avail_in = (unsigned int)bytes.size();
+	if (inflateInit(&stream) != Z_OK)
+		return false;
+
+	bool satisfied = false;
+	buffer.resize(std::min(initialSize, size));
+	while (true) {
+		stream.next_out = (unsigned char*)buffer.data() + stream.total_out;
+		stream.avail_out = (unsigned int)(buffer.size() - stream.total_out);
+		const auto status = inflate(&stream, Z_SYNC_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END)
+			break;
+		satisfied = consumer(std::span<const char>(buffer.data(), stream.total_out));
+		if (satisfied || status == Z_STREAM_END || buffer.size() == size)
+			break;
+		buffer.resize(std::min(buffer.size() * 2, size));
+	}
+	inflateEnd(&stream);
+	return satisfied;
+}
+
+bool GetMaterialPathsFromBsa(PathSet& pathSet, const std::string& path, PathSet* tableNames) {
 	bsa::fo4::archive ba2;
 	const auto version = ba2.read({ path });
 	if (!ba2.size())
 		return false;
+
+	struct NifEntry {
+		std::string name;
+		const bsa::fo4::file* file;
+	};
+	std::vector<NifEntry> nifs;
 	for (auto& [key, file] : ba2) {
 		std::string name(key.name());
-		if (HasExtension(name, ".nif")) {
-			const auto& nif = file.front();
-			std::vector<char> buffer(nif.decompressed_size());
-			nif.decompress_into({ (std::byte*)buffer.data(), buffer.size() }, (bsa::fo4::compression_format)file.header.format);
-			std::spanstream stream({ buffer.data(), buffer.size() });
-			if (!GetMaterialPathsFromNifStream(pathSet, stream))
-				Log("Failed to read compressed .nif file {} from {}", name, path);
+		if (HasExtension(name, ".nif") && !file.empty()) {
+			nifs.emplace_back(std::move(name), &file);
+		}
+		else if (tableNames && HasExtension(name, ".mat")) {
+			SanitizePrefixedPath(name, "material");
+			tableNames->emplace(std::move(name));
 		}
 	}
+	//Largest first so one big mesh doesn't finish alone at the end
+	std::sort(nifs.begin(), nifs.end(), [](const NifEntry& lhs, const NifEntry& rhs) {
+		return lhs.file->front().decompressed_size() > rhs.file->front().decompressed_size();
+	});
+
+	//Each worker reuses its buffer and fills its own set, the sets are merged once all are done
+	struct Worker {
+		std::vector<char> buffer;
+		PathSet pathSet;
+		std::vector<std::string> failed;
+	};
+	std::vector<Worker> workers(GetWorkerCount(nifs.size()));
+	ParallelForWorker(nifs.size(), [&](size_t w, size_t i) {
+		auto& worker = workers[w];
+		const auto& [name, file] = nifs[i];
+		const auto& nif = file->front();
+		const auto format = (bsa::fo4::compression_format)file->header.format;
+
+		auto result = NifHeaderResult::Truncated;
+		DecompressPrefix(nif, format, worker.buffer, [&](std::span<const char> data) {
+			result = GetMaterialPathsFromNifHeader(worker.pathSet, data);
+			return result != NifHeaderResult::Truncated;
+		});
+		if (result == NifHeaderResult::Done)
+			return;
+
+		//Headers the scanner doesn't know need the whole file for nifly
+		if (nif.compressed()) {
+			worker.buffer.resize(nif.decompressed_size());
+			nif.decompress_into({ (std::byte*)worker.buffer.data(), worker.buffer.size() }, format);
+		}
+		else {
+			const auto bytes = nif.as_bytes();
+			worker.buffer.assign((const char*)bytes.data(), (const char*)bytes.data() + bytes.size());
+		}
+		std::spanstream stream({ worker.buffer.data(), worker.buffer.size() });
+		if (!GetMaterialPathsFromNifStream(worker.pathSet, stream))
+			worker.failed.emplace_back(name);
+	});
+
+	for (auto& worker : workers) {
+		pathSet.merge(worker.pathSet);
+		for (const auto& name : worker.failed)
+			Log("Failed to read compressed .nif file {} from {}", name, path);
+	}
 	return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,109 @@
+#include "collisions.h"
+
+#include <array>
+#include <algorithm>
+#include <tuple>
+
+#include "crc.h"
+#include "types.h"
+#include "util.h"
+
+void SortResourceIds(std::vector<ResourceIdEntry>& entries) {
+	//16 bit digits, the ext halves first since they are the least significant
+	constexpr size_t digitCount = 1 << 16;
+	const std::array<uint32_t BSResource::ID::*, 3> fields{ &BSResource::ID::ext, &BSResource::ID::file, &BSResource::ID::dir };
+
+	std::vector<ResourceIdEntry> buffer(entries.size());
+	std::vector<uint32_t> offsets(digitCount);
+	for (const auto field : fields) {
+		for (const uint32_t shift : { 0u, 16u }) {
+			std::fill(offsets.begin(), offsets.end(), 0u);
+			for (const auto& entry : entries) {
+				offsets[(entry.id.*field >> shift) & 0xFFFF]++;
+			}
+			//A pass where every entry has the same digit keeps the order
+			if (offsets[(entries.empty() ? 0 : entries.front().id.*field >> shift) & 0xFFFF] == entries.size())
+				continue;
+
+			uint32_t sum = 0;
+			for (auto& offset : offsets) {
+				const auto count = offset;
+				offset = sum;
+				sum += count;
+			}
+			for (const auto& entry : entries) {
+				buffer[offsets[(entry.id.*field >> shift) & 0xFFFF]++] = entry;
+			}
+			entries.swap(buffer);
+		}
+	}
+}
+
+std::vector<ResourceIdEntry> GetSortedResourceIds(std::span<const std::string> paths) {
+	std::vector<ResourceIdEntry> result(paths.size());
+
+	constexpr size_t sliceSize = 0x4000;
+	ParallelFor((paths.size() + sliceSize - 1) / sliceSize, [&](size_t slice) {
+		const size_t begin = slice * sliceSize;
+		const size_t size = std::min(sliceSize, paths.size() - begin);
+		const auto ids = GetResourceIdsFromPaths(paths.subspan(begin, size));
+		for (size_t i = 0; i < size; ++i) {
+			result[begin + i] = { ids[i], (uint32_t)(begin + i) };
+		}
+	});
+
+	SortResourceIds(result);
+	return result;
+}
+
+static bool IsLess(const BSResource::ID& lhs, const BSResource::ID& rhs) {
+	return std::tie(lhs.dir, lhs.file, lhs.ext) < std::tie(rhs.dir, rhs.file, rhs.ext);
+}
+
+std::vector<ResourceCollision> FindCollisions(std::span<const std::string> paths, std::span<const BSResource::ID> databaseIds, const NameDictionary* names) {
+	std::vector<ResourceCollision> result;
+	const LowerBackslashEqual isSamePath;
+
+	const auto entries = GetSortedResourceIds(paths);
+
+	//Runs of equal ids, the same path spelled differently is not a collision
+	for (size_t begin = 0; begin < entries.size();) {
+		size_t end = begin + 1;
+		while (end < entries.size() && entries[end].id == entries[begin].id)
+			++end;
+		for (size_t i = begin + 1; i < end; ++i) {
+			const auto& path = paths[entries[i].index];
+			const bool seen = std::any_of(entries.begin() + begin, entries.begin() + i, [&](const ResourceIdEntry& entry) {
+				return isSamePath(paths[entry.index], path);
+			});
+			if (!seen)
+				result.emplace_back(entries[i].id, paths[entries[begin].index], path, false);
+		}
+		begin = end;
+	}
+
+	if (databaseIds.empty() || !names)
+		return result;
+
+	std::vector<ResourceIdEntry> dbEntries(databaseIds.size());
+	for (size_t i = 0; i < databaseIds.size(); ++i) {
+		dbEntries[i] = { databaseIds[i], (uint32_t)i };
+	}
+	SortResourceIds(dbEntries);
+
+	//Both lists are sorted, so one merge walk finds every shared id
+	auto dbIt = dbEntries.begin();
+	for (const auto& entry : entries) {
+		while (dbIt != dbEntries.end() && IsLess(dbIt->id, entry.id))
+			++dbIt;
+		if (dbIt == dbEntries.end())
+			break;
+		if (!(dbIt->id == entry.id))
+			continue;
+		const auto name = names->Find(entry.id);
+		if (name && !isSamePath(*name, paths[entry.index]))
+			result.emplace_back(entry.id, paths[entry.index], *name, true);
+	}
+
+	return result;
+}
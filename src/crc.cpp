@@ -2,7 +2,20 @@
 
 #include <array>
 #include <string_view>
-#include <format>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC_CLMUL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 #include "types.h"
 
@@ -267,52 +280,228 @@ constexpr std::array crcMap{
 	0x2D02EF8Du,
 };
 
-uint32_t GetCrc(const std::string_view sv) {
-	uint32_t result = 0;
+//crcMap extended to slicing by 8, crcSlices[0] is crcMap
+constexpr auto crcSlices = [] {
+	std::array<std::array<uint32_t, 256>, 8> result{};
+	result[0] = crcMap;
+	for (size_t i = 0; i < 256; ++i) {
+		for (size_t k = 1; k < result.size(); ++k) {
+			const auto prev = result[k - 1][i];
+			result[k][i] = crcMap[prev & 0xFF] ^ (prev >> 8);
+		}
+	}
+	return result;
+}();
+
+static uint32_t GetCrcBytewise(uint32_t result, const uint8_t* data, size_t size) {
 	constexpr auto transform = GetLowerBackslashMap();
-	for (const auto c : sv) {
-		result = crcMap[(uint8_t)(transform[c] ^ result)] ^ (result >> 8);
+	for (size_t i = 0; i < size; ++i) {
+		result = crcMap[(uint8_t)(transform[data[i]] ^ result)] ^ (result >> 8);
 	}
 	return result;
 }
 
-uint32_t GetExtension(const std::string& path, size_t dotPos) {
-	uint32_t result = 0;
+//Applies the lower/backslash map to 8 bytes at once, bytes >= 0x80 are left as is
+static inline uint64_t FoldLowerBackslash(uint64_t v) {
+	constexpr uint64_t ones = 0x0101010101010101u;
+	constexpr uint64_t high = 0x8080808080808080u;
+	const uint64_t low7 = v & ~high;
 
-	//auto extPos = path.find_last_of('.');
-	if (dotPos != std::string::npos) {
-		dotPos++;
-		auto ext = path.data() + dotPos;
-		result = *ext++;
-		if (++dotPos < path.size()) {
-			result |= *ext++ << 8;
-			if (++dotPos < path.size()) {
-				result |= *ext++ << 16;
-				if (++dotPos < path.size())
-					result |= *ext << 24;
-			}
-		}
+	//High bit set where 'A' <= c <= 'Z'
+	const uint64_t upper = (low7 + ones * (0x80 - 'A')) & ~(low7 + ones * (0x80 - 'Z' - 1)) & ~v & high;
+	v |= upper >> 2;
+
+	//High bit set where c == '/'
+	const uint64_t x = v ^ (ones * '/');
+	const uint64_t slash = ~(((x & ~high) + ~high) | x | ~high);
+	return v ^ ((slash >> 7) * ('/' ^ '\\'));
+}
+
+static uint32_t GetCrcSlicing8(uint32_t result, const uint8_t* data, size_t size) {
+	const auto& t = crcSlices;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint64_t v;
+		std::memcpy(&v, data, sizeof(v));
+		v = FoldLowerBackslash(v) ^ result;
+		result = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^ t[4][(v >> 24) & 0xFF] ^
+			t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^ t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
 	}
+	return GetCrcBytewise(result, data, size);
+}
 
-	return result;
+#ifdef CRC_CLMUL
+#ifdef _MSC_VER
+#define CRC_CLMUL_TARGET
+#else
+#define CRC_CLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+
+static bool HasClmul() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	const int ecx = info[2];
+#else
+	unsigned int eax, ebx, ecx = 0, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+	//PCLMULQDQ and SSE4.1
+	return (ecx & (1 << 1)) && (ecx & (1 << 19));
 }
 
-BSResource::ID GetResourceIdFromPath(const std::string& path) {
-	BSResource::ID result;
+CRC_CLMUL_TARGET static inline __m128i LoadFolded(const uint8_t* data) {
+	const __m128i v = _mm_loadu_si128((const __m128i*)data);
+	const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	const __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+	return _mm_xor_si128(_mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))), _mm_and_si128(slash, _mm_set1_epi8('/' ^ '\\')));
+}
+
+CRC_CLMUL_TARGET static inline __m128i Fold(__m128i x, __m128i k, __m128i next) {
+	const __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	const __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+//Folds 64 bytes per iteration with carry-less multiplies, then Barrett reduces
+//Constants are for the reflected 0x04C11DB7 polynomial, size must be >= 64 and a multiple of 16
+CRC_CLMUL_TARGET static uint32_t GetCrcClmulBlocks(uint32_t result, const uint8_t* data, size_t size) {
+	alignas(16) static constexpr uint64_t k1k2[] = { 0x0154442BD4u, 0x01C6E41596u };
+	alignas(16) static constexpr uint64_t k3k4[] = { 0x01751997D0u, 0x00CCAA009Eu };
+	alignas(16) static constexpr uint64_t k5k0[] = { 0x0163CD6124u, 0x0000000000u };
+	alignas(16) static constexpr uint64_t poly[] = { 0x01DB710641u, 0x01F7011641u };
+
+	__m128i x1 = _mm_xor_si128(LoadFolded(data), _mm_cvtsi32_si128((int)result));
+	__m128i x2 = LoadFolded(data + 0x10);
+	__m128i x3 = LoadFolded(data + 0x20);
+	__m128i x4 = LoadFolded(data + 0x30);
+	data += 64;
+	size -= 64;
 
-	auto slashPos = path.find_last_of("/\\");
-	auto dotPos = path.find_last_of('.');
+	__m128i k = _mm_load_si128((const __m128i*)k1k2);
 
-	if (slashPos != std::string::npos) {
-		result.dir = GetCrc({ path.data(), slashPos });
-		result.file = GetCrc({ path.data() + slashPos + 1, path.size() - slashPos - 1 - (path.size() - dotPos)});
+	for (; size >= 64; data += 64, size -= 64) {
+		x1 = Fold(x1, k, LoadFolded(data));
+		x2 = Fold(x2, k, LoadFolded(data + 0x10));
+		x3 = Fold(x3, k, LoadFolded(data + 0x20));
+		x4 = Fold(x4, k, LoadFolded(data + 0x30));
 	}
-	else {
-		//This isn't correct
-		result.dir = GetCrc(path);
-		result.file = GetCrc(path);
+
+	k = _mm_load_si128((const __m128i*)k3k4);
+	x1 = Fold(x1, k, x2);
+	x1 = Fold(x1, k, x3);
+	x1 = Fold(x1, k, x4);
+	for (; size >= 16; data += 16, size -= 16) {
+		x1 = Fold(x1, k, LoadFolded(data));
+	}
+
+	//128 to 64 bits
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	k = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00), x2);
+
+	//Barrett reduction to 32 bits
+	k = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), k, 0x00);
+	return (uint32_t)_mm_extract_epi32(_mm_xor_si128(x1, x2), 1);
+}
+
+static uint32_t GetCrcClmul(uint32_t result, const uint8_t* data, size_t size) {
+	//Short paths don't amortize the reduction
+	if (size >= 64) {
+		const size_t blocks = size & ~size_t(15);
+		result = GetCrcClmulBlocks(result, data, blocks);
+		data += blocks;
+		size -= blocks;
+	}
+	return GetCrcSlicing8(result, data, size);
+}
+#endif
+
+using CrcKernel = uint32_t(*)(uint32_t, const uint8_t*, size_t);
+
+static CrcKernel SelectCrcKernel() {
+#ifdef CRC_CLMUL
+	if (HasClmul())
+		return GetCrcClmul;
+#endif
+	return GetCrcSlicing8;
+}
+
+static const CrcKernel crcKernel = SelectCrcKernel();
+
+static_assert(crcTable == crcMap);
+static_assert(GetConstResourceId("materials\\layered\\root\\materials.mat").ext == 'tam');
+
+uint32_t GetCrcRuntime(const std::string_view sv) {
+	return crcKernel(0, (const uint8_t*)sv.data(), sv.size());
+}
+
+uint32_t ContinueCrc(uint32_t crc, const std::string_view sv) {
+	return crcKernel(crc, (const uint8_t*)sv.data(), sv.size());
+}
+
+//Hashes four strings in lockstep so the table lookups of each stream overlap
+static void GetCrc4(const std::string_view* svs, uint32_t* results) {
+	const auto& t = crcSlices;
+	uint32_t crcs[4] = {};
+	const size_t common = std::min({ svs[0].size(), svs[1].size(), svs[2].size(), svs[3].size() }) & ~size_t(7);
+	for (size_t pos = 0; pos < common; pos += 8) {
+		for (size_t s = 0; s < 4; ++s) {
+			uint64_t v;
+			std::memcpy(&v, svs[s].data() + pos, sizeof(v));
+			v = FoldLowerBackslash(v) ^ crcs[s];
+			crcs[s] = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^ t[4][(v >> 24) & 0xFF] ^
+				t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^ t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+		}
+	}
+	for (size_t s = 0; s < 4; ++s) {
+		results[s] = crcKernel(crcs[s], (const uint8_t*)svs[s].data() + common, svs[s].size() - common);
+	}
+}
+
+std::vector<BSResource::ID> GetResourceIdsFromPaths(std::span<const std::string> paths) {
+	std::vector<BSResource::ID> result(paths.size());
+	std::vector<std::string_view> files(paths.size());
+
+	//Paths usually come grouped by directory, so check the previous one before the cache
+	std::unordered_map<std::string_view, uint32_t> dirCrcs;
+	std::string_view lastDir;
+	uint32_t lastDirCrc = 0;
+	bool hasLastDir = false;
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		std::string_view dir;
+		size_t dotPos;
+		SplitResourcePath(paths[i], dir, files[i], dotPos);
+		result[i].ext = GetExtension(paths[i], dotPos);
+
+		if (!hasLastDir || dir != lastDir) {
+			auto [dirIt, inserted] = dirCrcs.try_emplace(dir, 0);
+			if (inserted)
+				dirIt->second = GetCrc(dir);
+			lastDir = dir;
+			lastDirCrc = dirIt->second;
+			hasLastDir = true;
+		}
+		result[i].dir = lastDirCrc;
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= files.size(); i += 4) {
+		uint32_t crcs[4];
+		GetCrc4(files.data() + i, crcs);
+		for (size_t s = 0; s < 4; ++s) {
+			result[i + s].file = crcs[s];
+		}
+	}
+	for (; i < files.size(); ++i) {
+		result[i].file = GetCrc(files[i]);
 	}
-	result.ext = GetExtension(path, dotPos);
 
 	return result;
 }
@@ -337,6 +526,80 @@ uint64_t GetHashFrom64(uintptr_t ptr) {
 	return hash;
 }
 
+//Spreads the 8 nibbles of value over 8 bytes and turns them into uppercase hex digits, most significant first
+static inline uint64_t GetHexDigits(uint32_t value) {
+	uint64_t x = value;
+	x = ((x & 0xFFFF0000u) << 16) | (x & 0x0000FFFFu);
+	x = ((x & 0x0000FF000000FF00u) << 8) | (x & 0x000000FF000000FFu);
+	x = ((x & 0x00F000F000F000F0u) << 4) | (x & 0x000F000F000F000Fu);
+	//Nibbles above 9 get the extra 7 that moves them from ':' to 'A'
+	const uint64_t letters = ((x + 0x0606060606060606u) >> 4) & 0x0101010101010101u;
+	return std::byteswap(x + 0x3030303030303030u + letters * 7);
+}
+
+char* FormatResourceId(const BSResource::ID& id, char* out) {
+	const uint64_t digits[3] = { GetHexDigits(id.dir), GetHexDigits(id.file), GetHexDigits(id.ext) };
+	std::memcpy(out, "res:", 4);
+	std::memcpy(out + 4, &digits[0], 8);
+	out[12] = ':';
+	std::memcpy(out + 13, &digits[1], 8);
+	out[21] = ':';
+	std::memcpy(out + 22, &digits[2], 8);
+	return out + formatedResourceIdSize;
+}
+
+void FormatResourceIds(std::span<const BSResource::ID> ids, char* out) {
+	for (const auto& id : ids) {
+		out = FormatResourceId(id, out);
+	}
+}
+
 std::string GetFormatedResourceId(const BSResource::ID& id) {
-	return std::format("res:{:08X}:{:08X}:{:08X}", id.dir, id.file, id.ext);
-}
\ No newline at end of file
+	std::string result(formatedResourceIdSize, '\0');
+	FormatResourceId(id, result.data());
+	return result;
+}
+
+//Hex digit values, 0xFF for anything else
+constexpr auto hexValues = [] {
+	std::array<uint8_t, 256> result{};
+	result.fill(0xFF);
+	for (int i = 0; i < 10; ++i) {
+		result['0' + i] = (uint8_t)i;
+	}
+	for (int i = 0; i < 6; ++i) {
+		result['A' + i] = (uint8_t)(10 + i);
+		result['a' + i] = (uint8_t)(10 + i);
+	}
+	return result;
+}();
+
+static inline bool ParseHex8(const char* str, uint32_t& value) {
+	uint32_t result = 0;
+	uint8_t invalid = 0;
+	for (size_t i = 0; i < 8; ++i) {
+		const uint8_t digit = hexValues[(uint8_t)str[i]];
+		invalid |= digit;
+		result = (result << 4) | (digit & 0xF);
+	}
+	value = result;
+	//Only invalid entries have bits above the low nibble
+	return !(invalid & 0xF0);
+}
+
+bool ParseFormatedResourceId(const std::string_view sv, BSResource::ID& id) {
+	//res:DIR:FILE:EXT
+	if (sv.size() != formatedResourceIdSize || !sv.starts_with("res:") || sv[12] != ':' || sv[21] != ':')
+		return false;
+	return ParseHex8(sv.data() + 4, id.dir) & ParseHex8(sv.data() + 13, id.file) & ParseHex8(sv.data() + 22, id.ext);
+}
+
+bool ParseFormatedResourceIds(std::string_view text, std::span<BSResource::ID> ids) {
+	if (text.size() != ids.size() * formatedResourceIdSize)
+		return false;
+	bool result = true;
+	for (size_t i = 0; i < ids.size(); ++i) {
+		result &= ParseFormatedResourceId(text.substr(i * formatedResourceIdSize, formatedResourceIdSize), ids[i]);
+	}
+	return result;
+}
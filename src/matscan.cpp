@@ -0,0 +1,123 @@
+#include "matscan.h"
+
+#include <cstring>
+#include <string>
+#include <bit>
+#include <algorithm>
+
+#include "util.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define MATSCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+//The terminator is part of the pattern, sizeof(matExt) in the original search
+constexpr char matPattern[] = ".mat";
+constexpr uint32_t matPatternSize = sizeof(matPattern);
+//The ring buffer held MAX_PATH bytes, so the longest prefix it could still read was for 258 byte strings
+constexpr uint32_t maxPathSize = 258;
+
+//Same transitions as the original search, a mismatch resets without retrying the byte
+uint32_t AdvanceMatState(uint32_t state, const char* begin, const char* end) {
+	for (const char* c = begin; c != end; ++c) {
+		if (*c == matPattern[state]) {
+			if (++state == matPatternSize)
+				state = 0;
+		}
+		else {
+			state = 0;
+		}
+	}
+	return state;
+}
+
+//Any other byte, or the terminator, always leaves the matcher at 0
+inline bool IsMatStateByte(char c) {
+	return c == '.' || c == 'm' || c == 'a' || c == 't';
+}
+
+//State before data[pos], only the run of pattern bytes before it matters
+uint32_t GetMatState(const char* data, size_t pos, uint32_t stateAtZero) {
+	size_t runStart = pos;
+	while (runStart && IsMatStateByte(data[runStart - 1]))
+		--runStart;
+	return AdvanceMatState(runStart ? 0 : stateAtZero, data + runStart, data + pos);
+}
+
+void MatPathScanner::Reset() {
+	historyLength = 0;
+	unsearched = 0;
+	historyState = 0;
+}
+
+std::span<char> MatPathScanner::Prepare(size_t size) {
+	buffer.resize(historyLength + size);
+	return { buffer.data() + historyLength, size };
+}
+
+void MatPathScanner::Scan(std::span<const char> data, PathSet& result) {
+	const auto dst = Prepare(data.size());
+	std::memcpy(dst.data(), data.data(), data.size());
+	Scan(data.size(), result);
+}
+
+void MatPathScanner::Scan(size_t size, PathSet& result) {
+	const char* data = buffer.data();
+	const size_t end = historyLength + size;
+	const size_t searchFrom = historyLength - unsearched;
+
+	//Bytes before the segment start were zero in the ring buffer
+	const auto& Byte = [data](ptrdiff_t pos) -> uint8_t {
+		return pos < 0 ? 0 : (uint8_t)data[pos];
+	};
+
+	const auto& OnPattern = [&](size_t pos) {
+		if (GetMatState(data, pos, historyState) != 0)
+			return;
+		//Shortest string whose size prefix matches, the size counts the terminator
+		for (uint32_t pathSize = matPatternSize; pathSize <= maxPathSize; ++pathSize) {
+			const ptrdiff_t start = (ptrdiff_t)pos + matPatternSize - pathSize;
+			if ((Byte(start - 2) | (Byte(start - 1) << 8)) == pathSize) {
+				std::string path(data + start, pathSize - 1);
+				SanitizePrefixedPath(path, "Materials");
+				result.emplace(std::move(path));
+				return;
+			}
+		}
+	};
+
+	size_t pos = searchFrom;
+	if (end >= matPatternSize) {
+		const size_t last = end - matPatternSize;
+#ifdef MATSCAN_SSE2
+		const __m128i dot = _mm_set1_epi8('.');
+		const __m128i m = _mm_set1_epi8('m');
+		const __m128i a = _mm_set1_epi8('a');
+		const __m128i t = _mm_set1_epi8('t');
+		const __m128i zero = _mm_setzero_si128();
+		for (; pos + 16 <= last + 1; pos += 16) {
+			const auto& Load = [data, pos](size_t offset) {
+				return _mm_loadu_si128((const __m128i*)(data + pos + offset));
+			};
+			const __m128i match = _mm_and_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(Load(0), dot), _mm_cmpeq_epi8(Load(1), m)),
+				_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(Load(2), a), _mm_cmpeq_epi8(Load(3), t)), _mm_cmpeq_epi8(Load(4), zero)));
+			for (uint32_t mask = _mm_movemask_epi8(match); mask; mask &= mask - 1)
+				OnPattern(pos + std::countr_zero(mask));
+		}
+#endif
+		for (; pos <= last; ++pos) {
+			if (std::memcmp(data + pos, matPattern, matPatternSize) == 0)
+				OnPattern(pos);
+		}
+	}
+
+	//Keep the tail for prefixes and patterns that cross into the next block
+	const size_t keep = std::min(end, historySize);
+	const size_t keepFrom = end - keep;
+	historyState = GetMatState(data, keepFrom, historyState);
+	unsearched = end - std::max(pos, keepFrom);
+	std::memmove(buffer.data(), data + keepFrom, keep);
+	historyLength = keep;
+}
@@ -0,0 +1,144 @@
+#include "names.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <tuple>
+
+#include "crc.h"
+#include "util.h"
+
+#include <nlohmann/json.hpp>
+
+//File layout: sig, version, count, then per name the id, a uint16 length and the path without terminator
+constexpr uint32_t namesSig = 'EMAN';
+constexpr uint32_t namesVersion = 1;
+
+std::string GetNameDictionaryPath(const std::filesystem::path& exeFolder) {
+	const auto settingsPath = std::filesystem::path(exeFolder).append("Settings.json");
+	std::ifstream in(settingsPath, std::ios::in | std::ios::binary);
+	if (!in.fail()) {
+		const auto settings = nlohmann::json::parse(in, nullptr, false);
+		if (settings.is_object() && settings.contains("names_path") && settings["names_path"].is_string())
+			return settings["names_path"].get<std::string>();
+	}
+	return std::filesystem::path(exeFolder).append("Names.dat").string();
+}
+
+size_t NameDictionary::Add(std::span<const std::string> paths) {
+	const auto ids = GetResourceIdsFromPaths(paths);
+	size_t added = 0;
+	names.reserve(names.size() + paths.size());
+	for (size_t i = 0; i < ids.size(); ++i) {
+		if (paths[i].size() <= UINT16_MAX)
+			added += names.try_emplace(ids[i], paths[i]).second;
+	}
+	return added;
+}
+
+size_t NameDictionary::Add(const PathSet& paths) {
+	const std::vector<std::string> pathList(paths.begin(), paths.end());
+	return Add(pathList);
+}
+
+size_t NameDictionary::Merge(const NameDictionary& other) {
+	size_t added = 0;
+	names.reserve(names.size() + other.names.size());
+	for (const auto& [id, path] : other.names) {
+		added += names.try_emplace(id, path).second;
+	}
+	return added;
+}
+
+bool NameDictionary::Load(const std::string& path) {
+	if (!std::filesystem::exists(path))
+		return true;
+
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (in.fail()) {
+		Log("Failed to open name dictionary {}", path);
+		return false;
+	}
+	std::vector<char> bytes((size_t)in.tellg());
+	in.seekg(0);
+	in.read(bytes.data(), bytes.size());
+
+	const char* pos = bytes.data();
+	const char* end = pos + bytes.size();
+	const auto& Read = [&pos, end](void* dst, size_t size) {
+		if ((size_t)(end - pos) < size)
+			return false;
+		std::memcpy(dst, pos, size);
+		pos += size;
+		return true;
+	};
+
+	uint32_t sig = 0, version = 0, count = 0;
+	if (!Read(&sig, 4) || !Read(&version, 4) || !Read(&count, 4) || sig != namesSig || version != namesVersion) {
+		Log("Invalid name dictionary {}", path);
+		return false;
+	}
+
+	names.reserve(names.size() + count);
+	for (uint32_t i = 0; i < count; ++i) {
+		BSResource::ID id;
+		uint16_t size;
+		if (!Read(&id.dir, 4) || !Read(&id.file, 4) || !Read(&id.ext, 4) || !Read(&size, 2) || (size_t)(end - pos) < size) {
+			Log("Truncated name dictionary {} at entry {}", path, i);
+			return false;
+		}
+		names.try_emplace(id, pos, size);
+		pos += size;
+	}
+	return true;
+}
+
+bool NameDictionary::Save(const std::string& path) const {
+	//Sorted so the same names always give the same file
+	std::vector<std::pair<BSResource::ID, const std::string*>> sorted;
+	sorted.reserve(names.size());
+	for (const auto& [id, name] : names) {
+		sorted.emplace_back(id, &name);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) {
+		return std::tie(lhs.first.dir, lhs.first.file, lhs.first.ext) < std::tie(rhs.first.dir, rhs.first.file, rhs.first.ext);
+	});
+
+	std::string bytes;
+	const auto& Write = [&bytes](const auto& value) {
+		bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	Write(namesSig);
+	Write(namesVersion);
+	Write((uint32_t)sorted.size());
+	for (const auto& [id, name] : sorted) {
+		Write(id.dir);
+		Write(id.file);
+		Write(id.ext);
+		Write((uint16_t)name->size());
+		bytes += *name;
+	}
+
+	//Written next to the target first so a failed write doesn't lose the old dictionary
+	const auto tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::out | std::ios::binary);
+		if (out.fail()) {
+			Log("Failed to write name dictionary {}", tmpPath);
+			return false;
+		}
+		out.write(bytes.data(), bytes.size());
+		if (out.fail()) {
+			Log("Failed to write name dictionary {}", tmpPath);
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec) {
+		Log("Failed to replace name dictionary {} {}", path, ec.message());
+		return false;
+	}
+	return true;
+}
@@ -2,25 +2,188 @@
 
 #include <nlohmann/json.hpp>
 
+#include <cstring>
+#include <spanstream>
+#include <sstream>
+
 #include "util.h"
+#include "scancache.h"
 
 #include <NifFile.hpp>
 using namespace nifly;
 
+void AddMaterialPath(PathSet& result, std::string matPath) {
+	SanitizePrefixedPath(matPath, "material");
+	result.emplace(std::move(matPath));
+}
+
 void GetMaterialPathsFromNifFile(PathSet& result, nifly::NifFile& nif) {
 	auto& header = nif.GetHeader();
 	auto size = header.GetNumBlocks();
 	for (uint32_t i = 0; i < size; ++i) {
 		auto object = header.GetBlock<NiObjectNET>(i);
-		if (object && HasExtension(object->name.get(), ".mat")) {
-			auto matPath(object->name.get());
-			SanitizePrefixedPath(matPath, "material");
-			result.emplace(std::move(matPath));
-		}
+		if (object && HasExtension(object->name.get(), ".mat"))
+			AddMaterialPath(result, object->name.get());
+	}
+}
+
+class NifSpanSource {
+	std::span<const char> data;
+	size_t pos = 0;
+
+public:
+	NifSpanSource(std::span<const char> _data) : data(_data) {}
+
+	bool Read(void* dst, size_t size) {
+		if (data.size() - pos < size)
+			return false;
+		std::memcpy(dst, data.data() + pos, size);
+		pos += size;
+		return true;
 	}
+
+	size_t Position() const { return pos; }
+
+	bool Skip(size_t size) {
+		if (data.size() - pos < size)
+			return false;
+		pos += size;
+		return true;
+	}
+};
+
+class NifStreamSource {
+	std::istream& stream;
+
+public:
+	NifStreamSource(std::istream& _stream) : stream(_stream) {}
+
+	bool Read(void* dst, size_t size) {
+		stream.read((char*)dst, size);
+		return (size_t)stream.gcount() == size;
+	}
+
+	bool Skip(size_t size) {
+		stream.seekg(size, std::ios::cur);
+		return !stream.fail();
+	}
+
+	size_t Position() { return (size_t)stream.tellg(); }
+};
+
+//Byte range of the string table, from the string count to the end of the last string
+struct NifStringTableRange {
+	size_t begin = 0;
+	size_t end = 0;
+};
+
+//Header layout from nif.xml for 20.2.0.7 with a BSStreamHeader, which covers Fallout 4, 76 and Starfield
+template<class Source>
+NifHeaderResult ReadNifHeaderStrings(Source& in, std::vector<std::string>& strings, NifStringTableRange* range = nullptr) {
+	using enum NifHeaderResult;
+
+	constexpr std::string_view magic = "Gamebryo File Format";
+	char line[128];
+	size_t lineSize = 0;
+	for (; lineSize < sizeof(line); ++lineSize) {
+		if (!in.Read(line + lineSize, 1))
+			return Truncated;
+		if (line[lineSize] == '\n')
+			break;
+	}
+	if (lineSize < magic.size() || std::string_view(line, magic.size()) != magic)
+		return Unsupported;
+
+	uint32_t version = 0, userVersion = 0, numBlocks = 0, bsVersion = 0;
+	uint8_t endian = 0;
+	if (!in.Read(&version, 4) || !in.Read(&endian, 1) || !in.Read(&userVersion, 4) || !in.Read(&numBlocks, 4))
+		return Truncated;
+	if (version != 0x14020007 || endian != 1 || userVersion < 3)
+		return Unsupported;
+
+	if (!in.Read(&bsVersion, 4))
+		return Truncated;
+	const auto& SkipExportString = [&in]() {
+		uint8_t size = 0;
+		return in.Read(&size, 1) && in.Skip(size);
+	};
+	const auto& SkipSizedString = [&in]() {
+		uint32_t size = 0;
+		return in.Read(&size, 4) && in.Skip(size);
+	};
+
+	uint32_t unknown = 0;
+	if (!SkipExportString() ||
+		(bsVersion > 130 && !in.Read(&unknown, 4)) ||
+		(bsVersion < 131 && !SkipExportString()) ||
+		!SkipExportString() ||
+		(bsVersion == 130 && !SkipExportString()))
+		return Truncated;
+
+	uint16_t numBlockTypes = 0;
+	if (!in.Read(&numBlockTypes, 2))
+		return Truncated;
+	for (uint16_t i = 0; i < numBlockTypes; ++i) {
+		if (!SkipSizedString())
+			return Truncated;
+	}
+	//Block type indices and block sizes
+	if (!in.Skip((size_t)numBlocks * (sizeof(uint16_t) + sizeof(uint32_t))))
+		return Truncated;
+
+	uint32_t numStrings = 0, maxStringSize = 0;
+	if (range)
+		range->begin = in.Position();
+	if (!in.Read(&numStrings, 4) || !in.Read(&maxStringSize, 4))
+		return Truncated;
+	strings.reserve(numStrings);
+	for (uint32_t i = 0; i < numStrings; ++i) {
+		uint32_t size = 0;
+		if (!in.Read(&size, 4))
+			return Truncated;
+		if (size > maxStringSize)
+			return Unsupported;
+		auto& string = strings.emplace_back(size, '\0');
+		if (!in.Read(string.data(), size))
+			return Truncated;
+	}
+	if (range)
+		range->end = in.Position();
+	return Done;
+}
+
+template<class Source>
+NifHeaderResult GetMaterialPathsFromNifSource(PathSet& result, Source& in) {
+	std::vector<std::string> strings;
+	const auto status = ReadNifHeaderStrings(in, strings);
+	if (status != NifHeaderResult::Done)
+		return status;
+	for (auto& string : strings) {
+		if (HasExtension(string, ".mat"))
+			AddMaterialPath(result, std::move(string));
+	}
+	return status;
+}
+
+NifHeaderResult GetMaterialPathsFromNifHeader(PathSet& result, std::span<const char> data) {
+	NifSpanSource in(data);
+	return GetMaterialPathsFromNifSource(result, in);
+}
+
+NifHeaderResult GetMaterialPathsFromNifHeader(PathSet& result, std::istream& stream) {
+	NifStreamSource in(stream);
+	return GetMaterialPathsFromNifSource(result, in);
 }
 
 bool GetMaterialPathsFromNifPath(PathSet& result, const std::filesystem::path& path) {
+	{
+		std::ifstream stream(path, std::ios::in | std::ios::binary);
+		if (stream.fail())
+			return false;
+		if (GetMaterialPathsFromNifHeader(result, stream) == NifHeaderResult::Done)
+			return true;
+	}
+
 	nifly::NifFile nif;
 	if (nif.Load(path) != 0)
 		return false;
@@ -29,6 +192,12 @@ bool GetMaterialPathsFromNifPath(PathSet& result, const std::filesystem::path& p
 }
 
 bool GetMaterialPathsFromNifStream(PathSet& result, std::istream& stream) {
+	const auto start = stream.tellg();
+	if (GetMaterialPathsFromNifHeader(result, stream) == NifHeaderResult::Done)
+		return true;
+	stream.clear();
+	stream.seekg(start);
+
 	nifly::NifFile nif;
 	if (nif.Load(stream) != 0)
 		return false;
@@ -36,17 +205,180 @@ bool GetMaterialPathsFromNifStream(PathSet& result, std::istream& stream) {
 	return true;
 }
 
-bool GetMaterialPathsFromNifsRecursive(PathSet& result, const std::filesystem::path& folder) {
+//Writes next to the target first and renames over it, so an interrupted run never leaves half a mesh
+bool WriteReplacing(const std::filesystem::path& path, std::span<const char> bytes) {
+	CreateDirectories(path.string());
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::out | std::ios::binary);
+		out.write(bytes.data(), bytes.size());
+		if (out.fail())
+			return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	return !ec;
+}
+
+bool RetargetNifMaterials(const std::filesystem::path& path, const std::filesystem::path& outPath, const NifStringRetarget& retarget, size_t& changed, std::vector<char>& buffer) {
+	changed = 0;
+	{
+		std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+		if (in.fail())
+			return false;
+		buffer.resize((size_t)in.tellg());
+		in.seekg(0);
+		in.read(buffer.data(), buffer.size());
+		if (in.fail())
+			return false;
+	}
+
+	//Blocks refer to strings by index, so the table can be rewritten as long as the order and count stay the same
+	std::vector<std::string> strings;
+	NifStringTableRange range;
+	NifSpanSource in(buffer);
+	if (ReadNifHeaderStrings(in, strings, &range) == NifHeaderResult::Done) {
+		uint32_t maxSize = 0;
+		for (auto& string : strings) {
+			if (HasExtension(string, ".mat") && retarget(string))
+				++changed;
+			maxSize = std::max(maxSize, (uint32_t)string.size());
+		}
+		if (!changed)
+			return true;
+
+		std::string bytes(buffer.data(), range.begin);
+		const auto& Write = [&bytes](uint32_t value) {
+			bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		};
+		Write((uint32_t)strings.size());
+		Write(maxSize);
+		for (const auto& string : strings) {
+			Write((uint32_t)string.size());
+			bytes += string;
+		}
+		bytes.append(buffer.data() + range.end, buffer.size() - range.end);
+		return WriteReplacing(outPath, bytes);
+	}
+
+	nifly::NifFile nif;
+	std::ispanstream stream(buffer);
+	if (nif.Load(stream) != 0)
+		return false;
+	auto& header = nif.GetHeader();
+	const auto size = header.GetNumBlocks();
+	for (uint32_t i = 0; i < size; ++i) {
+		auto object = header.GetBlock<NiObjectNET>(i);
+		if (!object || !HasExtension(object->name.get(), ".mat"))
+			continue;
+		auto name = object->name.get();
+		if (retarget(name)) {
+			object->name.set(name);
+			++changed;
+		}
+	}
+	if (!changed)
+		return true;
+
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	if (nif.Save(out) != 0)
+		return false;
+	const auto bytes = out.view();
+	return WriteReplacing(outPath, bytes);
+}
+
+bool GetMaterialPathsFromNifsRecursive(PathSet& result, const std::filesystem::path& folder, ScanCache* cache) {
 	std::error_code ec;
-	auto dirIt = std::filesystem::recursive_directory_iterator(folder, ec);
+	auto dirIt = std::filesystem::recursive_directory_iterator(std::filesystem::absolute(folder), ec);
 	if (ec)
 		return false;
 
-	for (const auto& entry : dirIt) {
-		if (HasExtension(entry.path().native(), L".nif")) {
-			GetMaterialPathsFromNifPath(result, entry.path());
+	struct Job {
+		std::filesystem::path path;
+		ScanCache::Stamp stamp;
+		bool stamped = false;
+	};
+	struct Scanned {
+		std::string source;
+		ScanCache::Stamp stamp;
+		PathSet pathSet;
+	};
+	//Each worker fills its own set and list of failures, they are merged once the folder is done
+	struct Worker {
+		PathSet pathSet;
+		std::vector<Scanned> scanned;
+		std::vector<std::filesystem::path> failed;
+	};
+
+	const size_t threadCount = GetThreadCount();
+	BoundedQueue<Job> queue(threadCount * 64);
+	std::vector<Worker> workers(threadCount);
+	std::atomic<size_t> done = 0;
+	std::mutex logLock;
+	size_t cached = 0;
+	{
+		std::vector<std::jthread> threads;
+		threads.reserve(threadCount);
+		for (auto& worker : workers) {
+			threads.emplace_back([&]() {
+				Job job;
+				while (queue.Pop(job)) {
+					PathSet found;
+					bool loaded = false;
+					try {
+						loaded = GetMaterialPathsFromNifPath(found, job.path);
+					}
+					catch (...) {}
+					if (!loaded)
+						worker.failed.emplace_back(std::move(job.path));
+					else if (job.stamped)
+						worker.scanned.emplace_back(job.path.string(), job.stamp, found);
+					worker.pathSet.merge(found);
+
+					if (const size_t count = ++done; count % 1000 == 0) {
+						std::lock_guard lock(logLock);
+						Log("Scanned {} .nif files", count);
+					}
+				}
+			});
+		}
+
+		//The walk stays on this thread so the cache is only touched here, misses are queued for the workers
+		for (auto it = std::filesystem::begin(dirIt); it != std::filesystem::end(dirIt); it.increment(ec)) {
+			if (ec)
+				break;
+			const auto& entry = *it;
+			if (!HasExtension(entry.path().native(), L".nif"))
+				continue;
+			Job job{ entry.path() };
+			job.stamped = cache && cache->GetStamp(entry, job.stamp);
+			if (job.stamped) {
+				if (const auto cached = cache->Find(job.path.string(), job.stamp)) {
+					result.insert(cached->paths.begin(), cached->paths.end());
+					++cached;
+					continue;
+				}
+			}
+			queue.Push(std::move(job));
 		}
+		queue.Close();
 	}
 
+	size_t failed = 0;
+	for (auto& worker : workers) {
+		result.merge(worker.pathSet);
+		for (const auto& scanned : worker.scanned) {
+			cache->Set(scanned.source, scanned.stamp, scanned.pathSet);
+		}
+		for (const auto& path : worker.failed) {
+			Log("Failed to read .nif file {}", path.string());
+		}
+		failed += worker.failed.size();
+	}
+	if (ec)
+		Log("Stopped reading folder {} {}", folder.string(), ec.message());
+	Log("Scanned {} .nif files in {}, {} unchanged since the last scan, {} failed", done + cached, folder.string(), cached, failed);
+
 	return true;
-}
\ No newline at end of file
+}
@@ -1,13 +1,16 @@
 #include "paths.h"
 
 #include <fstream>
+#include <cstring>
 #include <nlohmann/json.hpp>
+#include <miniz/miniz.h>
 
 #include "types.h"
 #include "util.h"
 #include "nif.h"
 #include "bsa.h"
 #include "esp.h"
+#include "matscan.h"
 
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
@@ -46,68 +49,6 @@ bool GetMaterialPathsFromEsp(PathSet& result, const std::string& espPath) {
 
     in.ReadHeader();
 
-    //std::unordered_set<uint32_t> matSigs;
-    //uint32_t currentGroup = 0;
-
-    const auto& FindPathsInStream = [&](std::istream& in, const uint32_t size) {
-        char buffer[MAX_PATH] = {};
-        uint32_t bufIdx = 0;
-        uint32_t checkIdx = 0;
-        uint32_t streamCount = 0;
-        while (streamCount < size) {
-            buffer[bufIdx] = in.get();
-            constexpr char matExt[] = ".mat";
-            //constexpr char matExtUpper[] = ".MAT";
-            //if (buffer[bufIdx] == matExt[checkIdx] || buffer[bufIdx] == matExtUpper[checkIdx]) {
-            if (buffer[bufIdx] == matExt[checkIdx]) {
-                if (++checkIdx == sizeof(matExt)) {
-                    uint32_t pathSize = sizeof(matExt);
-                    uint32_t pathIdx = bufIdx + 1;
-                    if (pathIdx < pathSize)
-                        pathIdx += MAX_PATH;
-                    pathIdx -= pathSize;
-                    uint8_t checkSize[2];
-                    while (pathSize < MAX_PATH) {
-                        if (pathIdx == 0)
-                            pathIdx = MAX_PATH;
-                        checkSize[1] = buffer[--pathIdx];
-                        if (pathIdx == 0)
-                            pathIdx = MAX_PATH;
-                        checkSize[0] = buffer[--pathIdx];
-                        if (*reinterpret_cast<uint16_t*>(checkSize) == pathSize) {
-                            pathIdx += 2;
-                            if (pathIdx >= MAX_PATH)
-                                pathIdx -= MAX_PATH;
-                            if (pathIdx + pathSize > MAX_PATH) {
-                                std::string path(buffer + pathIdx, MAX_PATH - pathIdx);
-                                path.append(buffer, pathIdx + pathSize - MAX_PATH - 1);
-                                SanitizePrefixedPath(path, "Materials");
-                                result.emplace(path);
-                                //matSigs.emplace(currentGroup);
-                            }
-                            else {
-                                std::string path(buffer + pathIdx, pathSize - 1);
-                                SanitizePrefixedPath(path, "Materials");
-                                result.emplace(path);
-                                //matSigs.emplace(currentGroup);
-                            }
-                            break;
-                        }
-                        ++pathIdx;
-                        ++pathSize;
-                    }
-                    checkIdx = 0;
-                }
-            }
-            else {
-                checkIdx = 0;
-            }
-            if (++bufIdx >= MAX_PATH)
-                bufIdx = 0;
-            ++streamCount;
-        }
-    };
-
     const std::vector<uint32_t> matGroups{
         Sig("LTEX"),
         Sig("ACTI"),
@@ -121,21 +62,91 @@ bool GetMaterialPathsFromEsp(PathSet& result, const std::string& espPath) {
         Sig("MTPT"),
     };
 
+    //Record payloads are read into a batch, which the worker pool then inflates and scans
+    struct Payload {
+        size_t offset;
+        uint32_t size;
+        bool compressed;
+    };
+    //Compressed records inflate straight into the scanner's buffer, so each worker reuses one allocation
+    struct Worker {
+        MatPathScanner scanner;
+        PathSet pathSet;
+        size_t failed = 0;
+    };
+    constexpr size_t batchSize = 0x4000000;
+    //Far above any real record, a larger size means the record is corrupt
+    constexpr uint32_t maxInflatedSize = 0x10000000;
+    std::vector<char> batch;
+    std::vector<Payload> payloads;
+    std::vector<Worker> workers(GetThreadCount());
+
+    const auto& ScanBatch = [&]() {
+        ParallelForWorker(payloads.size(), [&](size_t w, size_t i) {
+            auto& worker = workers[w];
+            const auto& payload = payloads[i];
+            const char* data = batch.data() + payload.offset;
+            worker.scanner.Reset();
+            if (!payload.compressed) {
+                worker.scanner.Scan({ data, payload.size }, worker.pathSet);
+                return;
+            }
+            //The inflated size leads the zlib data
+            uint32_t inflatedSize = 0;
+            if (payload.size >= 4)
+                std::memcpy(&inflatedSize, data, 4);
+            if (payload.size < 4 || inflatedSize > maxInflatedSize) {
+                ++worker.failed;
+                return;
+            }
+            mz_ulong dstLen = inflatedSize;
+            auto dst = worker.scanner.Prepare(inflatedSize);
+            if (uncompress((uint8_t*)dst.data(), &dstLen, (const uint8_t*)data + 4, payload.size - 4) != Z_OK) {
+                ++worker.failed;
+                return;
+            }
+            worker.scanner.Scan(dstLen, worker.pathSet);
+        });
+        batch.clear();
+        payloads.clear();
+    };
+
     in.ForEachGroup(matGroups, [&](const Group& group) {
-        FindPathsInStream(in.Stream(), group.size - 0x18);
+        auto& stream = in.Stream();
+        const uint32_t size = group.size - 0x18;
+        for (uint32_t count = 0; count < size;) {
+            Header header;
+            stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (stream.gcount() != sizeof(header))
+                break;
+            count += sizeof(header);
+            //Nested groups are walked in place, their records follow the header
+            if (header.group.sig == Sig("GRUP"))
+                continue;
+
+            const auto& record = header.record;
+            const size_t offset = batch.size();
+            batch.resize(offset + record.size);
+            stream.read(batch.data() + offset, record.size);
+            if ((uint32_t)stream.gcount() != record.size) {
+                batch.resize(offset);
+                break;
+            }
+            payloads.emplace_back(offset, record.size, record.IsCompressed());
+            count += record.size;
+            if (batch.size() >= batchSize)
+                ScanBatch();
+        }
     });
+    ScanBatch();
 
-    //in.ForEachGroup([&](const Group& group) {
-    //    currentGroup = group.value;
-    //    in.ForEachRecord(group, [&](const Record& record) {
-    //        FindPathsInStream(in.Stream(), record.size);
-    //    });
-    //});
-
-    //Log("Groups with materials");
-    //for (auto& sig : matSigs) {
-    //    Log("{}", std::string_view((char*)&sig, 4));
-    //}
+    size_t failed = 0;
+    for (auto& worker : workers) {
+        result.merge(worker.pathSet);
+        failed += worker.failed;
+    }
+    if (failed)
+        Log("Failed to inflate {} compressed records in {}", failed, espPath);
     return true;
 }
 
@@ -186,7 +197,37 @@ nlohmann::json ReadSettings(const std::string& path) {
     return result;
 }
 
+//Reuses the paths and dictionary names the source gave on an earlier run while its stamp matches, otherwise scans and records them
+template<class Functor>
+bool ScanCached(PathInfo& paths, PathSet& pathSet, const std::string& source, Functor&& scan) {
+    const auto key = std::filesystem::absolute(source).lexically_normal().string();
+    ScanCache::Stamp stamp;
+    const bool stamped = paths.scanCache.GetStamp(key, stamp);
+    if (stamped) {
+        if (const auto cached = paths.scanCache.Find(key, stamp)) {
+            pathSet.insert(cached->paths.begin(), cached->paths.end());
+            paths.names.Add(cached->names);
+            return true;
+        }
+    }
+    PathSet found;
+    PathSet names;
+    if (!scan(found, names))
+        return false;
+    if (stamped)
+        paths.scanCache.Set(key, stamp, found, &names);
+    paths.names.Add(names);
+    pathSet.merge(found);
+    return true;
+}
+
 bool GetAllPaths(PathInfo& paths, int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "-rescan" || arg == "-rs")
+            paths.scanCache.rescan = true;
+    }
+
     PathSet pathSet;
     for (int i = 1; i < argc; ++i) {
         std::string path(argv[i]);
@@ -225,21 +266,22 @@ bool GetAllPaths(PathInfo& paths, int argc, char** argv) {
         }
         else if (HasExtension(path, ".ba2")) {
             Log("Searching for .mat paths in {}", path);
-            if (!GetMaterialPathsFromBsa(pathSet, path)) {
+            const bool scanned = ScanCached(paths, pathSet, path, [&](PathSet& found, PathSet& names) { return GetMaterialPathsFromBsa(found, path, &names); });
+            if (!scanned) {
                 Log("Failed to open .nif file: {}", path);
                 continue;
             }
         }
         else if (HasExtension(path, ".esp") || HasExtension(path, ".esl") || HasExtension(path, ".esm")) {
             Log("Searching for .mat paths in {}", path);
-            if (!GetMaterialPathsFromEsp(pathSet, path)) {
+            if (!ScanCached(paths, pathSet, path, [&](PathSet& found, PathSet&) { return GetMaterialPathsFromEsp(found, path); })) {
                 Log("Failed to get paths from {}", path);
                 continue;
             }
         }
         else if (std::filesystem::is_directory(path)) {
             Log("Searching for .mat paths in .nif files for folder: {}", path);
-            if (!GetMaterialPathsFromNifsRecursive(pathSet, path)) {
+            if (!GetMaterialPathsFromNifsRecursive(pathSet, path, &paths.scanCache)) {
                 Log("Failed to get nif folder: {}", path);
                 continue;
             }
@@ -289,22 +331,25 @@ bool GetPathInfo(PathInfo& paths, int argc, char** argv) {
         return false;
     }
 
-    constexpr std::array rootMaterialPaths{
-        "materials\\layered\\root\\materials.mat",
-        "materials\\layered\\root\\blenders.mat",
-        "materials\\layered\\root\\texturesets.mat",
-        "materials\\layered\\root\\uvstreams.mat",
-        "materials\\layered\\root\\layers.mat",
-        "materials\\layered\\root\\layeredmaterials.mat",
-    };
+    paths.namesPath = GetNameDictionaryPath(rootPath);
+    paths.names.Load(paths.namesPath);
+    const size_t knownNames = paths.names.Size();
 
-    for (auto& path : rootMaterialPaths) {
-        paths.paths.emplace_back(path);
-    }
+    paths.scanCachePath = settings.contains("scan_cache_path") ? settings["scan_cache_path"].get<std::string>() : std::filesystem::path(rootPath).append("ScanCache.dat").string();
+    paths.scanCache.hashContents = settings.contains("scan_cache_hash") && settings["scan_cache_hash"].get<bool>();
+    paths.scanCache.Load(paths.scanCachePath);
 
     if (!GetAllPaths(paths, argc, argv))
         return false;
 
+    if (paths.scanCache.Changed())
+        paths.scanCache.Save(paths.scanCachePath);
+
+    //Every path found is kept, so later runs can name objects without rescanning
+    paths.names.Add(paths.materials);
+    if (paths.names.Size() != knownNames && paths.names.Save(paths.namesPath))
+        Log("Added {} names to {}", paths.names.Size() - knownNames, paths.namesPath);
+
     if (paths.materials.empty()) {
         std::cout << "Failed to find any .mat paths in";
         if (argc == 2) {
@@ -0,0 +1,216 @@
+#include "scancache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <string_view>
+
+#include "util.h"
+
+//File layout: sig, version, count, then per source a uint16 length and the path, the stamp,
+//a uint32 path count and per path a uint16 length and the path, then the names the same way
+constexpr uint32_t scanCacheSig = 'NACS';
+//Bumped whenever the layout changes or a scanner starts finding different paths
+//2 is the record level plugin scan, 3 added the names
+constexpr uint32_t scanCacheVersion = 3;
+
+//Hashes the contents in blocks, the file is read whole each time it's stamped
+uint64_t GetContentHash(const std::filesystem::path& path) {
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (in.fail())
+		return 0;
+	std::vector<char> block(0x100000);
+	uint64_t hash = 0xcbf29ce484222325;
+	while (in) {
+		in.read(block.data(), block.size());
+		const auto size = (size_t)in.gcount();
+		if (!size)
+			break;
+		hash = (hash ^ std::hash<std::string_view>()({ block.data(), size })) * 0x100000001b3;
+	}
+	return hash;
+}
+
+bool ScanCache::GetStamp(const std::filesystem::path& path, Stamp& stamp) const {
+	std::error_code ec;
+	stamp.size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return false;
+	stamp.time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	if (ec)
+		return false;
+	stamp.hash = hashContents ? GetContentHash(path) : 0;
+	return true;
+}
+
+bool ScanCache::GetStamp(const std::filesystem::directory_entry& entry, Stamp& stamp) const {
+	//Directory entries already carry the size and time from the folder walk
+	std::error_code ec;
+	stamp.size = entry.file_size(ec);
+	if (ec)
+		return false;
+	stamp.time = entry.last_write_time(ec).time_since_epoch().count();
+	if (ec)
+		return false;
+	stamp.hash = hashContents ? GetContentHash(entry.path()) : 0;
+	return true;
+}
+
+const ScanCache::Entry* ScanCache::Find(const std::string& source, const Stamp& stamp) const {
+	if (rescan)
+		return nullptr;
+	const auto it = entries.find(source);
+	if (it == entries.end())
+		return nullptr;
+	const auto& cached = it->second.stamp;
+	//A hash of 0 is a file that couldn't be read, or an entry written without hashContents
+	const bool matches = hashContents ? cached.size == stamp.size && cached.hash == stamp.hash && stamp.hash : cached == stamp;
+	return matches ? &it->second : nullptr;
+}
+
+void ScanCache::Set(const std::string& source, const Stamp& stamp, const PathSet& paths, const PathSet* names) {
+	const auto& Assign = [](std::vector<std::string>& dst, const PathSet& src) {
+		dst.clear();
+		for (const auto& matPath : src) {
+			if (matPath.size() <= UINT16_MAX)
+				dst.emplace_back(matPath);
+		}
+		std::sort(dst.begin(), dst.end());
+	};
+	auto& entry = entries[source];
+	entry.stamp = stamp;
+	Assign(entry.paths, paths);
+	if (names)
+		Assign(entry.names, *names);
+	else
+		entry.names.clear();
+	changed = true;
+}
+
+bool ScanCache::Load(const std::string& path) {
+	if (!std::filesystem::exists(path))
+		return true;
+
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (in.fail()) {
+		Log("Failed to open scan cache {}", path);
+		return false;
+	}
+	std::vector<char> bytes((size_t)in.tellg());
+	in.seekg(0);
+	in.read(bytes.data(), bytes.size());
+
+	const char* pos = bytes.data();
+	const char* end = pos + bytes.size();
+	const auto& Read = [&pos, end](void* dst, size_t size) {
+		if ((size_t)(end - pos) < size)
+			return false;
+		std::memcpy(dst, pos, size);
+		pos += size;
+		return true;
+	};
+	const auto& ReadString = [&](std::string& str) {
+		uint16_t size = 0;
+		if (!Read(&size, 2) || (size_t)(end - pos) < size)
+			return false;
+		str.assign(pos, size);
+		pos += size;
+		return true;
+	};
+	const auto& ReadStrings = [&](std::vector<std::string>& strs) {
+		uint32_t count = 0;
+		if (!Read(&count, 4))
+			return false;
+		strs.resize(count);
+		for (auto& str : strs) {
+			if (!ReadString(str))
+				return false;
+		}
+		return true;
+	};
+
+	uint32_t sig = 0, version = 0, count = 0;
+	if (!Read(&sig, 4) || !Read(&version, 4) || !Read(&count, 4) || sig != scanCacheSig || version != scanCacheVersion) {
+		Log("Invalid scan cache {}, sources will be rescanned", path);
+		return false;
+	}
+
+	entries.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		std::string source;
+		Entry entry;
+		if (!ReadString(source) || !Read(&entry.stamp.size, 8) || !Read(&entry.stamp.time, 8) || !Read(&entry.stamp.hash, 8) || !ReadStrings(entry.paths) || !ReadStrings(entry.names)) {
+			Log("Truncated scan cache {} at entry {}", path, i);
+			return false;
+		}
+		entries.insert_or_assign(std::move(source), std::move(entry));
+	}
+	return true;
+}
+
+bool ScanCache::Save(const std::string& path) const {
+	//Sorted so the same scans always give the same file
+	std::vector<const std::pair<const std::string, Entry>*> sorted;
+	sorted.reserve(entries.size());
+	for (const auto& entry : entries) {
+		sorted.emplace_back(&entry);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const auto* lhs, const auto* rhs) {
+		return lhs->first < rhs->first;
+	});
+
+	std::string bytes;
+	const auto& Write = [&bytes](const auto& value) {
+		bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	const auto& WriteString = [&](const std::string& str) {
+		Write((uint16_t)str.size());
+		bytes += str;
+	};
+	const auto& WriteStrings = [&](const std::vector<std::string>& strs) {
+		Write((uint32_t)strs.size());
+		for (const auto& str : strs) {
+			WriteString(str);
+		}
+	};
+	uint32_t count = 0;
+	for (const auto* entry : sorted) {
+		count += entry->first.size() <= UINT16_MAX;
+	}
+	Write(scanCacheSig);
+	Write(scanCacheVersion);
+	Write(count);
+	for (const auto* entry : sorted) {
+		const auto& [source, value] = *entry;
+		if (source.size() > UINT16_MAX)
+			continue;
+		WriteString(source);
+		Write(value.stamp.size);
+		Write(value.stamp.time);
+		Write(value.stamp.hash);
+		WriteStrings(value.paths);
+		WriteStrings(value.names);
+	}
+
+	//Written next to the target first so a failed write doesn't lose the old cache
+	const auto tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::out | std::ios::binary);
+		if (out.fail()) {
+			Log("Failed to write scan cache {}", tmpPath);
+			return false;
+		}
+		out.write(bytes.data(), bytes.size());
+		if (out.fail()) {
+			Log("Failed to write scan cache {}", tmpPath);
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec) {
+		Log("Failed to replace scan cache {} {}", path, ec.message());
+		return false;
+	}
+	return true;
+}